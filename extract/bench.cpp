@@ -0,0 +1,643 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#define STBI_ASSERT(x) CHECK(x)
+
+#include "car.h"
+#include "car_from_obj.h"
+#include "car_to_obj.h"
+#include "util/args.h"
+#include "util/color.h"
+#include "util/gzip.h"
+#include "util/io.h"
+#include "util/json.h"
+#include "util/obj.h"
+#include "vol.h"
+
+namespace miniz {
+#include "3p/miniz/miniz.c"
+}
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "3p/stb/stb_image.h"
+
+using namespace gt2;
+
+#ifdef _WIN32
+constexpr char kDefaultVoltool[] = "voltool.exe";
+constexpr char kDefaultCdotool[] = "cdotool.exe";
+constexpr char kNullDevice[] = "NUL";
+#else
+constexpr char kDefaultVoltool[] = "./voltool";
+constexpr char kDefaultCdotool[] = "./cdotool";
+constexpr char kNullDevice[] = "/dev/null";
+#endif
+
+static constexpr char kUsage[] =
+    "Usage:  bench [options...]\n"
+    "  Generates a synthetic corpus of cars (no game files needed), times the\n"
+    "  parsers and converters on it, and prints the results as JSON.\n"
+    "\n"
+    "Options:\n"
+    "  --cars N\n"
+    "    Cars in the corpus (default 8).\n"
+    "  --seed N\n"
+    "    Seed for the corpus; the same seed makes the same files (default 1).\n"
+    "  --min-ms N\n"
+    "    Milliseconds to run each benchmark for, at least (default 500).\n"
+    "  --filter text\n"
+    "    Only runs benchmarks with 'text' in their name.\n"
+    "  --out path\n"
+    "    Writes the JSON here instead of to stdout.\n"
+    "  --work path\n"
+    "    Folder for the end-to-end runs' files (default bench.work/).\n"
+    "  --voltool path, --cdotool path\n"
+    "    Tools for the end-to-end runs (default ./voltool and ./cdotool).\n"
+    "    Runs whose tool isn't there are skipped.\n"
+    "  -j N\n"
+    "    Threads for the end-to-end 'getobjs' run (default 1).\n"
+    "  --help\n"
+    "    Prints this message.\n";
+
+////////////////////////////////////////////////////////////////////////////////
+// Synthetic corpus.
+////////////////////////////////////////////////////////////////////////////////
+
+// Random cars which are valid enough for every tool to read and convert.
+//  - Sizes are about those of the game's cars; each CDO fits the 20K limit.
+class CorpusGenerator {
+ public:
+  explicit CorpusGenerator(uint32_t seed) : rng_(seed) {}
+
+  CarObject MakeCarObject() {
+    CarObject out;
+    out.header = {};
+    std::memcpy(out.header.magic, "GT\2\0", 4);
+    out.header.wheel_size[0] = {300, 200};
+    out.header.wheel_size[1] = {310, 210};
+    for (int i = 0; i < 4; ++i) {
+      const int16_t x = (i % 2 ? -800 : 800);
+      const int16_t z = (i / 2 ? -1200 : 1200);
+      out.header.wheel_pos[i] = Vec4<int16_t>(x, 100, z, 0);
+    }
+    out.padding.assign(0x828 / 2, 0);
+    out.num_lods = 3;
+    out.unknown1.assign(13, 0);
+    out.lods.push_back(MakeModel(120, 20, 20, 60, 80));
+    out.lods.push_back(MakeModel(60, 10, 10, 30, 40));
+    out.lods.push_back(MakeModel(16, 4, 4, 8, 8));
+    out.shadow = MakeShadow();
+    return out;
+  }
+
+  CarPix MakeCarPix(int num_palettes) {
+    CarPix out;
+    out.header = {};
+    out.header.num_palettes = num_palettes;
+    for (int i = 0; i < num_palettes; ++i) {
+      out.header.palette_id[i] = i + 1;
+      CarPix::Palette p = {};
+      // Mostly opaque colors, with some transparent ones.
+      for (Color16& c : p.data) {
+        c.data = (Uniform(0, 9) ? Uniform(1, 65535) : 0);
+      }
+      for (int k = 0; k < 16; ++k) {
+        p.is_emissive_data[k] = Uniform(0, 65535);
+        p.is_painted_data[k] = Uniform(0, 65535);
+      }
+      out.palettes.push_back(p);
+    }
+    out.data.resize(out.width * out.height / 2);
+    for (uint8_t& d : out.data) d = Uniform(0, 255);
+    return out;
+  }
+
+ private:
+  int Uniform(int lo, int hi) {
+    return std::uniform_int_distribution<int>(lo, hi)(rng_);
+  }
+
+  Normal32 MakeNormal() {
+    std::normal_distribution<float> d;
+    Normal32 n = {};
+    do {
+      const float x = d(rng_), y = d(rng_), z = d(rng_);
+      const float l = std::sqrt(x * x + y * y + z * z);
+      if (l < 0.1f) continue;
+      n.setf(x / l, y / l, z / l);
+    } while (!n.Validate());
+    return n;
+  }
+
+  Face MakeFace(const Model& m, bool quad, bool textured) {
+    Face f;
+    std::memset(&f, 0, sizeof(f));
+    for (int k = 0; k < 4; ++k) {
+      f.i_vert[k] = (quad || k < 3 ? Uniform(0, m.verts.size() - 1) : 0);
+    }
+    f.data_a = 0x10;  // Flags A: the bit that always seems to be set.
+    if (Uniform(0, 1)) {
+      f.data_b = 0x8 << 12;  // Flags B: a body face, with normals.
+      const int n = m.normals.size() - 1;
+      f.set_i_normals(Uniform(0, n), Uniform(0, n), Uniform(0, n),
+                      quad ? Uniform(0, n) : 0);
+    }
+    if (quad) {
+      f.set_quad();
+    } else {
+      f.set_tri();
+    }
+    if (textured) f.set_textured();
+    return f;
+  }
+
+  // Small faces scattered over the texture, clear of the wheel in the corner.
+  TexFace MakeTexFace(const Model& m, bool quad) {
+    TexFace f;
+    std::memset(&f, 0, sizeof(f));
+    static_cast<Face&>(f) = MakeFace(m, quad, /*textured=*/true);
+    const int x = Uniform(60, 243);
+    const int y = Uniform(12, 211);
+    const auto uv = [&] {
+      return Vec2<uint8_t>(x + Uniform(-12, 12), y + Uniform(-12, 12));
+    };
+    f.uv0 = uv();
+    f.uv1 = uv();
+    f.uv2 = uv();
+    if (quad) f.uv3 = uv();
+    f.set_i_palette(Uniform(0, 15));
+    return f;
+  }
+
+  Model MakeModel(int num_verts, int num_tris, int num_quads, int num_tex_tris,
+                  int num_tex_quads) {
+    Model m;
+    for (int i = 0; i < num_verts; ++i) {
+      m.verts.push_back(Vec4<int16_t>(Uniform(-2000, 2000), Uniform(-500, 500),
+                                      Uniform(-2000, 2000), 0));
+      m.normals.push_back(MakeNormal());
+    }
+    for (int i = 0; i < num_tris; ++i) {
+      m.tris.push_back(MakeFace(m, /*quad=*/false, /*textured=*/false));
+    }
+    for (int i = 0; i < num_quads; ++i) {
+      m.quads.push_back(MakeFace(m, /*quad=*/true, /*textured=*/false));
+    }
+    for (int i = 0; i < num_tex_tris; ++i) {
+      m.tex_tris.push_back(MakeTexFace(m, /*quad=*/false));
+    }
+    for (int i = 0; i < num_tex_quads; ++i) {
+      m.tex_quads.push_back(MakeTexFace(m, /*quad=*/true));
+    }
+
+    Model::Header& h = m.header;
+    h.num_verts = m.verts.size();
+    h.num_normals = m.normals.size();
+    h.num_tris = m.tris.size();
+    h.num_quads = m.quads.size();
+    h.num_tex_tris = m.tex_tris.size();
+    h.num_tex_quads = m.tex_quads.size();
+    h.lo_bound = Vec4<int16_t>(-2000, -500, -2000, 0);
+    h.hi_bound = Vec4<int16_t>(2000, 500, 2000, 0);
+    return m;
+  }
+
+  // A square, as one tri and one quad.
+  CarObject::Shadow MakeShadow() {
+    CarObject::Shadow s;
+    s.header = {};
+    s.header.num_verts = 4;
+    s.header.num_tris = 1;
+    s.header.num_quads = 1;
+    s.header.lo_bound = Vec4<int16_t>(-900, 0, -1300, 0);
+    s.header.hi_bound = Vec4<int16_t>(900, 0, 1300, 0);
+    s.verts = {Vec2<int16_t>(-900, -1300), Vec2<int16_t>(900, -1300),
+               Vec2<int16_t>(900, 1300), Vec2<int16_t>(-900, 1300)};
+    s.tris = {{0 | (1 << 6) | (2 << 12)}};
+    s.quads = {{0 | (1 << 6) | (2 << 12) | (3 << 18) | (0x80u << 24)}};
+    return s;
+  }
+
+  std::mt19937 rng_;
+};
+
+// One car of the corpus, and what the benchmarks make from it up front.
+struct Car {
+  // The rest is filled in by 'MakeCar'. (CarPix can't be assigned.)
+  Car(std::string name, CarObject cdo, CarPix cdp)
+      : name(std::move(name)), cdo(std::move(cdo)), cdp(std::move(cdp)) {}
+
+  std::string name;  // E.g. "car0".
+  CarObject cdo;
+  CarPix cdp;
+  std::string cdo_data;  // As extracted.
+  std::string cdp_data;
+  std::string cdo_gz;  // As stored in a VOL.
+  std::string cdp_gz;
+
+  CarObject::UvPalette uv_palette = {Image8(0, 0), Image8(0, 0), {}};
+  Image8 texture = Image8(0, 0);  // Skin 0.
+  std::string obj;                // LOD 0, as written by 'WriteObj'.
+  ColorHistogram colors;          // Every color of 'texture'.
+  TexturePaletteData faces;       // Colors of each face of LOD 0.
+};
+
+Car MakeCar(CorpusGenerator& gen, int i) {
+  Car c(StrCat("car", i), gen.MakeCarObject(), gen.MakeCarPix(1 + i % 4));
+  VecOutStream cdo_data, cdp_data;
+  c.cdo.Serialize(cdo_data);
+  c.cdp.Serialize(cdp_data);
+  c.cdo_data = cdo_data.GetData();
+  c.cdp_data = cdp_data.GetData();
+  c.cdo_gz = GzipCompress(c.cdo_data);
+  c.cdp_gz = GzipCompress(c.cdp_data);
+
+  c.uv_palette = c.cdo.DrawUvPalette();
+  c.texture = c.cdp.Texture(0, c.uv_palette.index, c.uv_palette.mask,
+                            &c.uv_palette.dilation);
+  ObjWriter obj;
+  ObjState state;
+  WriteObj(obj, state, c.cdo.lods[0]);
+  c.obj = std::string(obj.str());
+  ColorCounter counter;
+  const std::vector<uint8_t>& px = c.texture.pixels;
+  for (int i = 0; i < px.size(); i += 4) {
+    counter.Add(RgbaToColor16(px[i], px[i + 1], px[i + 2], px[i + 3]));
+  }
+  c.colors = counter.Take();
+  c.faces = ExtractFacePalettes(c.texture, c.cdo.lods[0]);
+  return c;
+}
+
+// Lays out a VOL with every file in one folder, "/car/". Files are stored in
+// order and 2048-byte aligned, like the game's.
+std::string MakeVol(
+    const std::vector<std::pair<std::string, std::string>>& files) {
+  CHECK(!files.empty());
+  constexpr int64_t kAlign = 2048;
+  const auto align = [](int64_t x) {
+    return (x + kAlign - 1) / kAlign * kAlign;
+  };
+
+  // The root, then "/car/" and its files. Folders start with "..".
+  Vol::FileInfo info;
+  std::memset(&info, 0, sizeof(info));
+  std::vector<Vol::FileInfo> infos;
+  const auto add = [&](std::string_view name, uint8_t flags, int offset) {
+    CHECK_LE(name.size(), sizeof(info.name_), name);
+    std::memset(info.name_, 0, sizeof(info.name_));
+    std::memcpy(info.name_, name.data(), name.size());
+    info.flags = flags;
+    info.offset_index = offset;
+    infos.push_back(info);
+  };
+  add("", kVolFlagDir | kVolFlagEnd, 0xFFFF);
+  add("..", kVolFlagDir, 0xFFFF);
+  add("car", kVolFlagDir | kVolFlagEnd, 0xFFFF);
+  add("..", kVolFlagDir, 0xFFFF);
+  for (int i = 0; i < files.size(); ++i) {
+    add(files[i].first, (i + 1 == files.size() ? kVolFlagEnd : 0), 2 + i);
+  }
+
+  // Offsets 0 and 1 locate the tables; 'pad' is the slack after each entry.
+  const int num_offsets = 2 + files.size();
+  const int64_t info_pos = align(0x10 + num_offsets * sizeof(Vol::Offset));
+  int64_t pos = align(info_pos + infos.size() * sizeof(Vol::FileInfo));
+  std::vector<Vol::Offset> offsets(num_offsets);
+  offsets[0].value = info_pos - 0x10 - num_offsets * sizeof(Vol::Offset);
+  offsets[1].value =
+      info_pos | (pos - info_pos - infos.size() * sizeof(Vol::FileInfo));
+
+  std::string out(pos, '\0');
+  for (int i = 0; i < files.size(); ++i) {
+    const std::string& data = files[i].second;
+    // The last file runs to the end of the VOL.
+    const int64_t end =
+        (i + 1 == files.size() ? pos + data.size() : align(pos + data.size()));
+    offsets[2 + i].value = pos | (end - pos - data.size());
+    out.append(data);
+    out.resize(end);
+    pos = end;
+  }
+
+  Vol::Header header;
+  std::memcpy(header.magic, "GTFS\0\0\0\0", 8);
+  header.num_offsets = num_offsets;
+  header.num_file_infos = infos.size();
+  std::memcpy(&out[0], &header, sizeof(header));
+  std::memcpy(&out[0x10], offsets.data(), num_offsets * sizeof(Vol::Offset));
+  std::memcpy(&out[info_pos], infos.data(),
+              infos.size() * sizeof(Vol::FileInfo));
+  return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Timing.
+////////////////////////////////////////////////////////////////////////////////
+
+// Runs benchmarks and collects their results.
+//  - Each benchmark is a function doing one op, which returns the bytes it
+//    read or made, for throughput (0 if that means nothing).
+//  - One untimed op warms up, then ops run until 'min_seconds' have passed.
+class Bench {
+ public:
+  Bench(std::string filter, double min_seconds)
+      : filter_(std::move(filter)), min_seconds_(min_seconds) {}
+
+  // True if benchmark 'name' passes the filter.
+  bool Selected(const std::string& name) const {
+    return name.find(filter_) != std::string::npos;
+  }
+
+  template <typename Fn>
+  void Run(const std::string& name, Fn&& fn) {
+    if (!Selected(name)) return;
+    using Clock = std::chrono::steady_clock;
+    fn();  // Warm up.
+    Result r{name};
+    const auto start = Clock::now();
+    std::chrono::duration<double> elapsed(0);
+    do {
+      r.bytes += fn();
+      ++r.iterations;
+      elapsed = Clock::now() - start;
+    } while (elapsed.count() < min_seconds_);
+    r.seconds = elapsed.count();
+    std::cerr << std::left << std::setw(40) << name << std::right
+              << std::setw(12) << std::fixed << std::setprecision(0)
+              << r.ns_per_op() << " ns/op" << std::endl;
+    results_.push_back(r);
+  }
+
+  // The results, with a description of the corpus.
+  std::string ToJson(int num_cars, uint32_t seed, int64_t vol_bytes) const {
+    std::ostringstream f;
+    f << std::fixed << std::setprecision(1);
+    f << "{\n";
+    f << "  \"corpus\": {\"cars\": " << num_cars << ", \"seed\": " << seed
+      << ", \"vol_bytes\": " << vol_bytes << "},\n";
+    f << "  \"benchmarks\": [";
+    for (int i = 0; i < results_.size(); ++i) {
+      const Result& r = results_[i];
+      f << (i > 0 ? "," : "") << "\n    {\"name\": " << JsonQuote(r.name)
+        << ", \"iterations\": " << r.iterations
+        << ", \"ns_per_op\": " << r.ns_per_op();
+      if (r.bytes > 0) {
+        f << ", \"bytes_per_op\": " << r.bytes / r.iterations
+          << ", \"mb_per_s\": " << r.bytes / r.seconds / 1e6;
+      }
+      f << "}";
+    }
+    f << "\n  ]\n}\n";
+    return f.str();
+  }
+
+ private:
+  struct Result {
+    std::string name;
+    int64_t iterations = 0;
+    int64_t bytes = 0;
+    double seconds = 0;
+    double ns_per_op() const { return seconds * 1e9 / iterations; }
+  };
+
+  std::string filter_;
+  double min_seconds_;
+  std::vector<Result> results_;
+};
+
+// Runs a tool with its output thrown away. FAILs if it fails.
+int64_t RunTool(const std::string& command) {
+  const std::string quiet = StrCat(command, " > ", kNullDevice, " 2>&1");
+  CHECK_EQ(std::system(quiet.c_str()), 0, "Failed (run it to see why): ",
+           command);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks.
+////////////////////////////////////////////////////////////////////////////////
+
+// Ops that take one car's data cycle through the corpus, one car per op.
+void RunMicroBenchmarks(Bench& bench, const std::vector<Car>& cars,
+                        const std::string& vol_data) {
+  const auto cycle = [&cars](auto&& fn) {
+    return [&cars, fn, i = 0]() mutable {
+      return fn(cars[i++ % cars.size()]);
+    };
+  };
+
+  bench.Run("vol/Vol::FromStream", [&] {
+    ViewInStream s(vol_data);
+    const Vol vol = Vol::FromStream(s);
+    return vol.files.size() * sizeof(Vol::FileInfo);
+  });
+
+  Inflater inflater;
+  bench.Run("gzip/GzipMember::FromStream", cycle([&](const Car& c) {
+              ViewInStream cdo(c.cdo_gz), cdp(c.cdp_gz);
+              return GzipMember::FromStream(cdo, &inflater).inflated_size +
+                     GzipMember::FromStream(cdp, &inflater).inflated_size;
+            }));
+
+  bench.Run("car/CarObject::FromStream", cycle([](const Car& c) {
+              ViewInStream s(c.cdo_data);
+              const CarObject cdo = CarObject::FromStream(s);
+              return static_cast<int64_t>(c.cdo_data.size());
+            }));
+
+  // As 'inspect' reads them: headers only, normals unchecked.
+  bench.Run("car/CarObjectView::FromStream", cycle([](const Car& c) {
+              ViewInStream s(c.cdo_data);
+              const CarObjectView cdo =
+                  CarObjectView::FromStream(s, /*check_normals=*/false);
+              return static_cast<int64_t>(c.cdo_data.size());
+            }));
+
+  bench.Run("car/CarPix::FromStream", cycle([](const Car& c) {
+              ViewInStream s(c.cdp_data);
+              const CarPix cdp = CarPix::FromStream(s);
+              return static_cast<int64_t>(c.cdp_data.size());
+            }));
+
+  bench.Run("car/CarObject::DrawUvPalette", cycle([](const Car& c) {
+              const CarObject::UvPalette uv = c.cdo.DrawUvPalette();
+              return static_cast<int64_t>(uv.index.pixels.size());
+            }));
+
+  bench.Run("car/CarPix::Texture", cycle([](const Car& c) {
+              const CarObject::UvPalette& uv = c.uv_palette;
+              const Image8 tex =
+                  c.cdp.Texture(0, uv.index, uv.mask, &uv.dilation);
+              return static_cast<int64_t>(tex.pixels.size());
+            }));
+
+  bench.Run("image/Image::ToPng", cycle([](const Car& c) {
+              return static_cast<int64_t>(c.texture.ToPng().size());
+            }));
+
+  Image8 tris(256, 224, 1);
+  TriangleRasterizer raster;
+  bench.Run("image/Image::DrawTriangle", cycle([&](const Car& c) {
+              for (const Model& m : c.cdo.lods) {
+                for (const TexFace& f : m.tex_tris) {
+                  const uint8_t p = f.i_palette();
+                  tris.DrawTriangle(f.uv0, f.uv1, f.uv2, p, raster);
+                }
+                for (const TexFace& f : m.tex_quads) {
+                  const uint8_t p = f.i_palette();
+                  tris.DrawTriangle(f.uv0, f.uv1, f.uv2, p, raster);
+                  tris.DrawTriangle(f.uv0, f.uv2, f.uv3, p, raster);
+                }
+              }
+              return 0;
+            }));
+
+  Image8 texture(256, 224, 4);
+  bench.Run("image/Dilation", cycle([&](const Car& c) {
+              const Dilation d(c.uv_palette.mask, 1);
+              d.Apply(texture);
+              return static_cast<int64_t>(texture.pixels.size());
+            }));
+
+  for (const Quantizer q : {Quantizer::kFarthest, Quantizer::kMedianCut}) {
+    const char* name = (q == Quantizer::kFarthest ? "farthest" : "median-cut");
+    bench.Run(StrCat("color/QuantizeColors/", name),
+              cycle([q](const Car& c) {
+                ColorHistogram colors = c.colors;
+                QuantizeColors(colors, /*n=*/16, q);
+                return 0;
+              }));
+  }
+
+  bench.Run("car_from_obj/MergePalettes", cycle([](const Car& c) {
+              std::vector<PaletteData> palettes = c.faces.palettes;
+              MergePalettes(palettes, /*max_palettes=*/12, /*max_colors=*/16);
+              return 0;
+            }));
+
+  ObjWriter obj;
+  bench.Run("obj/WriteObj", cycle([&](const Car& c) {
+              obj.Clear();
+              ObjState state;
+              WriteObj(obj, state, c.cdo.lods[0]);
+              return static_cast<int64_t>(obj.str().size());
+            }));
+
+  bench.Run("obj/Obj::FromString", cycle([](const Car& c) {
+              std::ostringstream log;
+              const Obj o = Obj::FromString(c.obj, log);
+              return static_cast<int64_t>(c.obj.size());
+            }));
+
+  // Whole conversions, in memory.
+  for (const char* profile : {"minimal", "viewer", "debug", "gpu"}) {
+    ExportOptions options;
+    options.profile = ExportProfileFromString(profile);
+    bench.Run(StrCat("car_to_obj/ExportObj/", profile),
+              cycle([options](const Car& c) {
+                int64_t n = 0;
+                ExportObj(c.cdo, c.cdp, c.name + ".cd", /*make_wheels=*/true,
+                          options,
+                          [&n](const std::string&, std::string_view data) {
+                            n += data.size();
+                          });
+                return n;
+              }));
+  }
+}
+
+// Runs the tools as a user would, reading and writing files in 'work'.
+void RunEndToEnd(Bench& bench, const std::string& work,
+                 const std::string& voltool, const std::string& cdotool,
+                 int num_threads) {
+  const std::string vol = work + "bench.vol";
+  const auto quote = [](const std::string& s) { return StrCat("\"", s, "\""); };
+
+  if (std::filesystem::exists(voltool)) {
+    bench.Run("e2e/voltool getobjs", [&] {
+      return RunTool(StrCat(quote(voltool), " ", quote(vol), " getobjs ",
+                            quote(work + "objs/"), " \".*cdo.*\" -j ",
+                            num_threads));
+    });
+  } else {
+    std::cerr << "No voltool at '" << voltool << "'; skipping." << std::endl;
+  }
+
+  // Its setup needs both tools, so check the filter first.
+  if (!bench.Selected("e2e/cdotool packcdo")) return;
+  if (std::filesystem::exists(voltool) && std::filesystem::exists(cdotool)) {
+    // Repack the first car from its own OBJs. Wheels don't go back in.
+    const std::string in = work + "pack/";
+    RunTool(StrCat(quote(voltool), " ", quote(vol), " getobjs-nowheels ",
+                   quote(in), " \".*car0.cdo.*\" --profile minimal"));
+    bench.Run("e2e/cdotool packcdo", [&] {
+      return RunTool(StrCat(quote(cdotool), " packcdo ",
+                            quote(work + "car0.cdo"), " ",
+                            quote(in + "car0.cdo.0.obj"), " ",
+                            quote(in + "out/")));
+    });
+  } else {
+    std::cerr << "No cdotool at '" << cdotool << "' (or no voltool); skipping."
+              << std::endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  Args args(argc, argv);
+  if (args.PopSwitch("--help")) {
+    std::cerr << kUsage << std::endl;
+    return 0;
+  }
+  const int num_cars = args.PopInt("--cars", 8);
+  CHECK_GT(num_cars, 0, "--cars needs at least one car.");
+  const uint32_t seed = args.PopInt("--seed", 1);
+  const double min_seconds = args.PopInt("--min-ms", 500) / 1000.0;
+  const std::string filter = args.PopString("--filter");
+  const std::string out_path = args.PopString("--out");
+  std::string work = args.PopString("--work", "bench.work/");
+  if (!EndsWith(work, "/")) work += "/";
+  const std::string voltool = args.PopString("--voltool", kDefaultVoltool);
+  const std::string cdotool = args.PopString("--cdotool", kDefaultCdotool);
+  const int num_threads = args.PopInt("-j", 1);
+  CHECK_GT(num_threads, 0, "-j needs at least one thread.");
+  if (args.size() != 1) {
+    std::cerr << "Unknown argument: " << args[1] << "\n" << std::endl;
+    std::cerr << kUsage << std::endl;
+    return -1;
+  }
+
+  // Make the corpus, and save it for the end-to-end runs.
+  CorpusGenerator gen(seed);
+  std::vector<Car> cars;
+  std::vector<std::pair<std::string, std::string>> files;
+  for (int i = 0; i < num_cars; ++i) {
+    cars.push_back(MakeCar(gen, i));
+    files.emplace_back(cars[i].name + ".cdo.gz", cars[i].cdo_gz);
+    files.emplace_back(cars[i].name + ".cdp.gz", cars[i].cdp_gz);
+  }
+  const std::string vol_data = MakeVol(files);
+  Save(vol_data, work + "bench.vol");
+  Save(cars[0].cdo_data, work + "car0.cdo");
+  std::cerr << "Corpus: " << num_cars << " cars, " << vol_data.size()
+            << " byte VOL in " << work << std::endl;
+
+  Bench bench(filter, min_seconds);
+  RunMicroBenchmarks(bench, cars, vol_data);
+  RunEndToEnd(bench, work, voltool, cdotool, num_threads);
+
+  const std::string json = bench.ToJson(num_cars, seed, vol_data.size());
+  if (out_path.empty()) {
+    std::cout << json << std::flush;
+  } else {
+    Save(json, out_path);
+  }
+  return 0;
+}
@@ -7,7 +7,7 @@ else
   FILENAME=cdotool
 fi
 
-clang++ --std=c++17 -O2 -s -fno-exceptions -Wall -Wextra -Werror \
+clang++ --std=c++17 -O2 -s -fno-exceptions -pthread -Wall -Wextra -Werror \
     -Wno-unused-parameter \
     -Wno-unused-const-variable \
     -Wno-unused-variable \
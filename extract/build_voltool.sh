@@ -3,11 +3,12 @@
 
 if [[ ("$OSTYPE" == "msys"*) ]] || [[ ("$OSTYPE" == "cygwin"*) ]]; then
   FILENAME=voltool.exe
+  LIBS=-lws2_32  # Sockets, for 'serve'.
 else
   FILENAME=voltool
 fi
 
-clang++ --std=c++17 -O2 -s -fno-exceptions -Wall -Wextra -Werror \
+clang++ --std=c++17 -O2 -s -fno-exceptions -pthread -Wall -Wextra -Werror \
     -Wno-unused-parameter \
     -Wno-unused-const-variable \
     -Wno-unused-variable \
@@ -15,6 +16,6 @@ clang++ --std=c++17 -O2 -s -fno-exceptions -Wall -Wextra -Werror \
     -Wno-c++11-narrowing \
     -static-libstdc++ \
     -static \
-  voltool.cpp -o $FILENAME
+  voltool.cpp -o $FILENAME $LIBS
     # -static-libstdc++ \
     # -fsanitize=address \
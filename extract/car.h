@@ -6,6 +6,7 @@
 
 #include <bitset>
 #include <cmath>
+#include <cstring>
 #include <functional>
 #include <ostream>
 #include <vector>
@@ -346,6 +347,15 @@ std::ostream& operator<<(std::ostream& os, const TexFace& f) {
             << " c:" << std::bitset<6>(f.flags_d()) << "}";
 }
 
+// CHECKs that each normal has unit length. 'normals' is a vector or ArrayView.
+template <typename Normals>
+void CheckNormals(const Normals& normals) {
+  for (int i = 0; i < normals.size(); ++i) {
+    const Normal32 n = normals[i];
+    CHECK(n.Validate(), "Bad normal. i=", i, n, n.len());
+  }
+}
+
 // One level-of-detail (LOD) from a cno/cdo.
 struct Model {
   struct Header {
@@ -387,10 +397,7 @@ struct Model {
     out.header = s.template Read<Model::Header>();
     out.verts = s.template Read<Vec4<int16_t>>(out.header.num_verts);
     out.normals = s.template Read<Normal32>(out.header.num_normals);
-    for (int i = 0; i < out.header.num_normals; ++i) {
-      const Normal32& n = out.normals[i];
-      CHECK(n.Validate(), "Bad normal. i=", i, n, n.len());
-    }
+    CheckNormals(out.normals);
     out.tris = s.template Read<Face>(out.header.num_tris);
     out.quads = s.template Read<Face>(out.header.num_quads);
     out.tex_tris = s.template Read<TexFace>(out.header.num_tex_tris);
@@ -407,33 +414,71 @@ struct Model {
     out.Write(tex_tris);
     out.Write(tex_quads);
   }
+};
 
-  // Each face has a palette index used for color lookup.
-  // We can draw the palette indices into a UV map the size of the texture.
-  //  'palette' contains the 4-msb of the palette_index for each texel.
-  //  'mask' is 255 wherever palette values were set, 0 otherwise.
-  void DrawPaletteUvs(Image8& palette, Image8& mask) const {
-    CHECK_EQ(palette.width, 256);
-    CHECK_EQ(palette.height, 224);
-    CHECK_EQ(palette.channels, 1);
-    CHECK_EQ(mask.width, 256);
-    CHECK_EQ(mask.height, 224);
-    CHECK_EQ(mask.channels, 1);
-    for (const auto& f : tex_tris) {
-      uint8_t value = (f.i_palette() << 4);
-      palette.DrawTriangle(f.uv0, f.uv1, f.uv2, value);
-      mask.DrawTriangle(f.uv0, f.uv1, f.uv2, 255);
-    }
-    for (const auto& f : tex_quads) {
-      uint8_t value = (f.i_palette() << 4);
-      palette.DrawTriangle(f.uv0, f.uv1, f.uv2, value);
-      palette.DrawTriangle(f.uv0, f.uv2, f.uv3, value);
-      mask.DrawTriangle(f.uv0, f.uv1, f.uv2, 255);
-      mask.DrawTriangle(f.uv0, f.uv2, f.uv3, 255);
-    }
+// A read-only Model over the bytes of a cno/cdo. None of the arrays are copied,
+// and the normals are only checked if asked. The bytes must outlive the view.
+struct ModelView {
+  Model::Header header;
+  ArrayView<Vec4<int16_t>> verts;
+  ArrayView<Normal32> normals;
+  ArrayView<Face> tris;
+  ArrayView<Face> quads;
+  ArrayView<TexFace> tex_tris;
+  ArrayView<TexFace> tex_quads;
+
+  static ModelView FromStream(ViewInStream& s, bool check_normals = true) {
+    ModelView out;
+    out.header = s.Read<Model::Header>();
+    out.verts = s.ReadArray<Vec4<int16_t>>(out.header.num_verts);
+    out.normals = s.ReadArray<Normal32>(out.header.num_normals);
+    if (check_normals) CheckNormals(out.normals);
+    out.tris = s.ReadArray<Face>(out.header.num_tris);
+    out.quads = s.ReadArray<Face>(out.header.num_quads);
+    out.tex_tris = s.ReadArray<TexFace>(out.header.num_tex_tris);
+    out.tex_quads = s.ReadArray<TexFace>(out.header.num_tex_quads);
+    return out;
   }
 };
 
+// Each face has a palette index used for color lookup.
+// We can draw the palette indices into a UV map the size of the texture.
+//  'm' is a Model or a ModelView.
+//  'palette' contains the 4-msb of the palette_index for each texel.
+//  'mask' is 255 wherever palette values were set, 0 otherwise.
+// Each triangle is rasterized once, and fills both images.
+template <typename Lod>
+void DrawPaletteUvs(const Lod& m, Image8& palette, Image8& mask,
+                    TriangleRasterizer& raster) {
+  CHECK_EQ(palette.width, 256);
+  CHECK_EQ(palette.height, 224);
+  CHECK_EQ(palette.channels, 1);
+  CHECK_EQ(mask.width, 256);
+  CHECK_EQ(mask.height, 224);
+  CHECK_EQ(mask.channels, 1);
+  const auto draw = [&](Vec2<uint8_t> a, Vec2<uint8_t> b, Vec2<uint8_t> c,
+                        uint8_t value) {
+    raster.Rasterize(a, b, c, 256, 224, [&](int y, int lo, int hi) {
+      uint8_t* const row = &palette.pixels[y * 256];
+      std::fill(row + lo, row + hi + 1, value);
+      uint8_t* const mask_row = &mask.pixels[y * 256];
+      std::fill(mask_row + lo, mask_row + hi + 1, 255);
+    });
+  };
+  for (const auto& f : m.tex_tris) {
+    draw(f.uv0, f.uv1, f.uv2, f.i_palette() << 4);
+  }
+  for (const auto& f : m.tex_quads) {
+    draw(f.uv0, f.uv1, f.uv2, f.i_palette() << 4);
+    draw(f.uv0, f.uv2, f.uv3, f.i_palette() << 4);
+  }
+}
+template <typename Lod>
+void DrawPaletteUvs(const Lod& m, Image8& palette, Image8& mask) {
+  TriangleRasterizer raster;
+  DrawPaletteUvs(m, palette, mask, raster);
+}
+
 std::ostream& operator<<(std::ostream& os, const Model::Header& h) {
   return os << "{ Model "                                          //
             << std::setw(3) << h.num_verts << " verts  "           //
@@ -561,6 +606,7 @@ struct CarObject {
 
   template <typename Stream>
   static CarObject FromStream(Stream& s) {
+    TraceScope trace("CarObject::FromStream");
     CarObject out;
 
     out.header = s.template Read<Header>();
@@ -592,17 +638,34 @@ struct CarObject {
   }
 
   // Each model face contains a palette index. We can extract it to a UV map.
+  //  'padding' is how many texels textures get grown by around the UVs.
   struct UvPalette {
-    Image8 index;  // Palette index for every texel.
-    Image8 mask;   // Zero where there are no UVs.
+    Image8 index = Image8(0, 0);  // Palette index for every texel.
+    Image8 mask = Image8(0, 0);   // Zero where there are no UVs.
+    Dilation dilation;            // Grows textures around 'mask'.
   };
-  UvPalette DrawUvPalette() const {
-    UvPalette out{
-        Image8(256, 224, 1),
-        Image8(256, 224, 1),
-    };
+  UvPalette DrawUvPalette(int padding = 1) const {
+    return UvPaletteOf(lods, padding);
+  }
+  // The same, into 'out', reusing its memory.
+  void DrawUvPalette(int padding, UvPalette& out) const {
+    UvPaletteOf(lods, padding, out);
+  }
+  // The same, for any list of Models or ModelViews.
+  template <typename Lods>
+  static UvPalette UvPaletteOf(const Lods& lods, int padding) {
+    UvPalette out;
+    UvPaletteOf(lods, padding, out);
+    return out;
+  }
+  template <typename Lods>
+  static void UvPaletteOf(const Lods& lods, int padding, UvPalette& out) {
+    TraceScope trace("CarObject::DrawUvPalette");
+    out.index.Reset(256, 224, 1);
+    out.mask.Reset(256, 224, 1);
+    static thread_local TriangleRasterizer raster;
     for (const auto& model : lods) {
-      model.DrawPaletteUvs(out.index, out.mask);
+      DrawPaletteUvs(model, out.index, out.mask, raster);
     }
     {  // Draw the palette index for the wheel.
       const uint8_t value = 0;
@@ -616,8 +679,64 @@ struct CarObject {
         x0 += 256;
       }
     }
+    out.dilation.Build(out.mask, padding);
+  }
+};
+
+// A read-only CarObject over the bytes of a cdo/cno, for listing, inspecting
+// and converting without copying any of the mesh data.
+//  - The bytes must outlive the view.
+//  - Normals are only checked if 'check_normals'; see CheckNormals.
+struct CarObjectView {
+  struct ShadowView {
+    CarObject::Shadow::Header header;
+    ArrayView<Vec2<int16_t>> verts;  // x,z only.
+    ArrayView<CarObject::Shadow::Face> tris;
+    ArrayView<CarObject::Shadow::Face> quads;
+  };
+
+  CarObject::Header header;
+  uint16_t num_lods;
+  std::vector<uint16_t> unknown1;  // Only 13 of them; copied.
+  std::vector<ModelView> lods;
+  ShadowView shadow;
+
+  static CarObjectView FromStream(ViewInStream& s, bool check_normals = true) {
+    TraceScope trace("CarObjectView::FromStream");
+    CarObjectView out;
+
+    out.header = s.Read<CarObject::Header>();
+    CHECK(out.header.Validate());
+
+    const std::string_view padding = s.ReadView(0x828);
+    CHECK(IsZero(reinterpret_cast<const uint8_t*>(padding.data()),
+                 padding.size()));
+
+    out.num_lods = s.Read<uint16_t>();
+    out.unknown1 = s.Read<uint16_t>(13);
+
+    out.lods.reserve(out.num_lods);
+    for (int i = 0; i < out.num_lods; ++i) {
+      out.lods.push_back(ModelView::FromStream(s, check_normals));
+    }
+
+    out.shadow.header = s.Read<CarObject::Shadow::Header>();
+    out.shadow.verts = s.ReadArray<Vec2<int16_t>>(out.shadow.header.num_verts);
+    out.shadow.tris =
+        s.ReadArray<CarObject::Shadow::Face>(out.shadow.header.num_tris);
+    out.shadow.quads =
+        s.ReadArray<CarObject::Shadow::Face>(out.shadow.header.num_quads);
+
+    CHECK_EQ(s.remain(), 0);
     return out;
   }
+
+  CarObject::UvPalette DrawUvPalette(int padding = 1) const {
+    return CarObject::UvPaletteOf(lods, padding);
+  }
+  void DrawUvPalette(int padding, CarObject::UvPalette& out) const {
+    CarObject::UvPaletteOf(lods, padding, out);
+  }
 };
 
 std::ostream& operator<<(std::ostream& os,
@@ -643,7 +762,9 @@ std::ostream& operator<<(std::ostream& os, const CarObject::Shadow::Header& h) {
             << "\n unknown4: " << static_cast<int>(h.unknown4) << "\n}";
 }
 
-std::ostream& operator<<(std::ostream& os, const CarObject& f) {
+// Headers and counts of a CarObject or CarObjectView.
+template <typename Object>
+std::ostream& WriteCarObjectHeaders(std::ostream& os, const Object& f) {
   os << f.header << "\nunknown1: " << ToString(f.unknown1)
      << "\nnum_lods: " << f.num_lods << "\n";
   for (const auto& m : f.lods) {
@@ -652,6 +773,14 @@ std::ostream& operator<<(std::ostream& os, const CarObject& f) {
   return os << f.shadow.header << std::endl;
 }
 
+std::ostream& operator<<(std::ostream& os, const CarObject& f) {
+  return WriteCarObjectHeaders(os, f);
+}
+
+std::ostream& operator<<(std::ostream& os, const CarObjectView& f) {
+  return WriteCarObjectHeaders(os, f);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // CDP/CNP (Car picture? (what the heck does the 'p' stand for?) data files).
 ////////////////////////////////////////////////////////////////////////////////
@@ -697,6 +826,7 @@ struct CarPix {
 
   template <typename Stream>
   static CarPix FromStream(Stream& s) {
+    TraceScope trace("CarPix::FromStream");
     CarPix out;
     out.header = s.template Read<Header>();
 
@@ -739,16 +869,20 @@ struct CarPix {
   // visualization. However, the data actually forms the 4 LSB of an index into
   // the palette.
   Image8 Pixels() const {
-    Image8 out(width, height, 1);
-    out.pixels.clear();
-    for (const uint8_t pixel : data) {
-      const uint8_t a = (pixel << 4) & 0xF0;
-      out.pixels.push_back(a);
-      const uint8_t b = pixel & 0xF0;
-      out.pixels.push_back(b);
-    }
+    Image8 out(0, 0);
+    Pixels(out);
     return out;
   }
+  // The same, into 'out', reusing its memory.
+  void Pixels(Image8& out) const {
+    out.Reset(width, height, 1);
+    out.pixels.resize(data.size() * 2);
+    for (int i = 0; i < data.size(); ++i) {
+      const uint8_t pixel = data[i];
+      out.pixels[2 * i] = (pixel << 4) & 0xF0;
+      out.pixels[2 * i + 1] = pixel & 0xF0;
+    }
+  }
 
   // Gets palette 'p' as an NxN image.
   // The 'palette_index' from the obj data point to a row in this palette.
@@ -768,69 +902,156 @@ struct CarPix {
     return out;
   }
 
-  // Unpacks the 32-bit RGBA texture stored in this CarPix using palette 'p'.
-  // The 'palette_msb' must be the 4-bit value from each face of the 3d model,
-  // stored in the 4 MSB of each pixel in a UV-space image.
-  Image8 Texture(int p, const Image8& palette_msb, const Image8& mask) const {
+  // Palette colors as 4-byte RGBA pixels, ready to copy into images.
+  struct PaletteLut {
+    uint32_t color[256];  // What 'PushPixel' would write.
+    uint32_t flags[256];  // See 'FlagDebugTexture'.
+  };
+
+  // Expands palette 'p' into lookup tables.
+  PaletteLut Lut(int p) const {
     const Palette& palette = palettes[p];
-    Image8 texture(width, height, 4);
-    texture.pixels.clear();
-    int i = 0;
-    for (const uint8_t pixel : data) {
-      {
-        const uint8_t p_msb = palette_msb.pixels[i];
-        if (mask.pixels[i]) {
-          PushPixel(texture, palette.data[p_msb | (pixel & 0xF)]);
-        } else {
-          PushPixel(texture, {});
+    const auto pack = [](uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+      const uint8_t rgba[4] = {r, g, b, a};
+      uint32_t out;
+      std::memcpy(&out, rgba, sizeof(out));
+      return out;
+    };
+    PaletteLut lut;
+    for (int i = 0; i < 256; ++i) {
+      const Color16 c = palette.data[i];
+      lut.color[i] = pack(c.r(), c.g(), c.b(), c.opaque() ? 255 : 0);
+      const uint8_t emissive = palette.is_emissive(i) ? 255 : 0;
+      const uint8_t painted = palette.is_painted(i) ? 255 : 0;
+      lut.flags[i] = pack(emissive, emissive, painted, c.opaque() ? 255 : 0);
+    }
+    return lut;
+  }
+
+  // Decodes the textures for palette 'p' in one pass over the pixels. Any of
+  // the outputs may be null, and is skipped.
+  //  - 'texture': see 'Texture'.
+  //  - 'brake': see 'BrakeLightTexture'.
+  //  - 'flags': see 'FlagDebugTexture'.
+  //  'dilation' grows the texture around the mask; by one texel if null.
+  void DecodeTextures(int p, const Image8& palette_msb, const Image8& mask,
+                      Image8* texture, Image8* brake, Image8* flags,
+                      const Dilation* dilation = nullptr) const {
+    const int n = width * height;
+    CHECK_LE(width, 256);
+    CHECK_EQ(data.size() * 2, n);
+    CHECK_EQ(palette_msb.pixels.size(), n);
+    CHECK(!texture || mask.pixels.size() == n);
+
+    const PaletteLut lut = Lut(p);
+    // Brake lights use the last row of the palette.
+    constexpr uint8_t kBrakeMsb = 224;
+    const uint32_t* brake_lut = lut.color + 240;
+
+    uint8_t* const out_texture = Prepare(texture);
+    uint8_t* const out_brake = Prepare(brake);
+    uint8_t* const out_flags = Prepare(flags);
+
+    // Rows at a time: first the indices, then the lookups, so each loop is
+    // simple enough for the compiler to vectorize.
+    uint8_t lsb[256];
+    uint8_t index[256];
+    for (int row = 0; row < n; row += width) {
+      const uint8_t* packed = data.data() + row / 2;
+      for (int x = 0; x < width / 2; ++x) {
+        lsb[2 * x] = packed[x] & 0xF;
+        lsb[2 * x + 1] = packed[x] >> 4;
+      }
+      const uint8_t* msb = palette_msb.pixels.data() + row;
+      for (int x = 0; x < width; ++x) index[x] = msb[x] | lsb[x];
+
+      if (out_texture) {
+        const uint8_t* m = mask.pixels.data() + row;
+        uint8_t* out = out_texture + 4 * row;
+        for (int x = 0; x < width; ++x) {
+          const uint32_t c = (m[x] ? lut.color[index[x]] : 0);
+          std::memcpy(out + 4 * x, &c, sizeof(c));
         }
-        ++i;
       }
-      {
-        const uint8_t p_msb = palette_msb.pixels[i];
-        if (mask.pixels[i]) {
-          PushPixel(texture, palette.data[p_msb | (pixel >> 4)]);
-        } else {
-          PushPixel(texture, {});
+      if (out_brake) {
+        uint8_t* out = out_brake + 4 * row;
+        for (int x = 0; x < width; ++x) {
+          const uint32_t c = (msb[x] == kBrakeMsb ? brake_lut[lsb[x]] : 0);
+          std::memcpy(out + 4 * x, &c, sizeof(c));
         }
-        ++i;
+      }
+      if (out_flags) {
+        uint8_t* out = out_flags + 4 * row;
+        for (int x = 0; x < width; ++x) {
+          std::memcpy(out + 4 * x, &lut.flags[index[x]], sizeof(uint32_t));
+        }
+      }
+    }
+
+    if (texture) {
+      // Expand the texture to get rid of jaggies near the seams.
+      if (dilation) {
+        dilation->Apply(*texture);
+      } else {
+        Dilation(mask, 1).Apply(*texture);
       }
     }
-    // Expand the texture to get rid of jaggies near the seams.
-    Image8 grow_mask = mask;
-    texture.GrowBorders(grow_mask);
+  }
+
+  // Unpacks the 32-bit RGBA texture stored in this CarPix using palette 'p'.
+  // The 'palette_msb' must be the 4-bit value from each face of the 3d model,
+  // stored in the 4 MSB of each pixel in a UV-space image.
+  Image8 Texture(int p, const Image8& palette_msb, const Image8& mask,
+                 const Dilation* dilation = nullptr) const {
+    Image8 texture(width, height, 4);
+    DecodeTextures(p, palette_msb, mask, &texture, nullptr, nullptr, dilation);
     return texture;
   }
 
+  // Palette indices for a lookup on the GPU, as a gray+alpha image. Gray is
+  // the full 8-bit index (see 'Texture' on 'palette_msb'), alpha the mask.
+  // Grown like 'Texture', so it serves every palette.
+  Image8 IndexTexture(const Image8& palette_msb, const Image8& mask,
+                      const Dilation* dilation = nullptr) const {
+    const int n = width * height;
+    CHECK_EQ(data.size() * 2, n);
+    CHECK_EQ(palette_msb.pixels.size(), n);
+    CHECK_EQ(mask.pixels.size(), n);
+
+    Image8 out(width, height, 2);
+    for (int i = 0; i < n; i += 2) {
+      const uint8_t packed = data[i / 2];
+      const uint8_t lsb[2] = {uint8_t(packed & 0xF), uint8_t(packed >> 4)};
+      for (int k = 0; k < 2; ++k) {
+        const bool m = mask.pixels[i + k];
+        out.pixels[2 * (i + k)] = (m ? palette_msb.pixels[i + k] | lsb[k] : 0);
+        out.pixels[2 * (i + k) + 1] = (m ? 255 : 0);
+      }
+    }
+    if (dilation) {
+      dilation->Apply(out);
+    } else {
+      Dilation(mask, 1).Apply(out);
+    }
+    return out;
+  }
+
+  // All the palettes as one RGBA image, a row each: texel (i, p) is what
+  // 'Texture' would write for index 'i' of palette 'p'.
+  Image8 PaletteStrip() const {
+    Image8 out(256, palettes.size(), 4);
+    for (int p = 0; p < palettes.size(); ++p) {
+      const PaletteLut lut = Lut(p);
+      std::memcpy(&out.at(0, p), lut.color, sizeof(lut.color));
+    }
+    return out;
+  }
+
   // Unpacks the brake light texture for a palette (rest is transparent).
   // See notes on 'Texture(...)' above.
   Image8 BrakeLightTexture(int p, const Image8& palette_msb) const {
-    const Palette& palette = palettes[p];
     Image8 texture(width, height, 4);
-    texture.pixels.clear();
-    int i = 0;
-    for (const uint8_t pixel : data) {
-      {
-        if (palette_msb.pixels[i] == 224) {
-          const uint8_t p_msb = 240;
-          const uint8_t p_lsb = pixel & 0xF;
-          PushPixel(texture, palette.data[p_msb | p_lsb]);
-        } else {
-          PushPixel(texture, {});
-        }
-        ++i;
-      }
-      {
-        if (palette_msb.pixels[i] == 224) {
-          const uint8_t p_msb = 240;
-          const uint8_t p_lsb = (pixel >> 4);
-          PushPixel(texture, palette.data[p_msb | p_lsb]);
-        } else {
-          PushPixel(texture, {});
-        }
-        ++i;
-      }
-    }
+    DecodeTextures(p, palette_msb, palette_msb, nullptr, &texture, nullptr);
     return texture;
   }
 
@@ -841,36 +1062,38 @@ struct CarPix {
   //   green: 255 if emissive, 0 otherwise.
   //   blue:  255 if painted, 0 otherwise.
   Image8 FlagDebugTexture(int p, const Image8& palette_msb) const {
-    const Palette& palette = palettes[p];
     Image8 texture(width, height, 4);
-    texture.pixels.clear();
-    int i = 0;
-    for (const uint8_t pixel : data) {
-      {
-        const uint8_t p_msb = palette_msb.pixels[i];
-        const uint8_t p_lsb = pixel & 0xF;
-        const uint8_t ic = p_msb | p_lsb;
-        const Color16 c = palette.data[ic];
-        texture.pixels.push_back(palette.is_emissive(ic) ? 255 : 0);
-        texture.pixels.push_back(palette.is_emissive(ic) ? 255 : 0);
-        texture.pixels.push_back(palette.is_painted(ic) ? 255 : 0);
-        texture.pixels.push_back(c.opaque() ? 255 : 0);
-        ++i;
-      }
-      {
-        const uint8_t p_msb = palette_msb.pixels[i];
-        const uint8_t p_lsb = (pixel >> 4);
-        const uint8_t ic = p_msb | p_lsb;
-        const Color16 c = palette.data[ic];
-        texture.pixels.push_back(palette.is_emissive(ic) ? 255 : 0);
-        texture.pixels.push_back(palette.is_emissive(ic) ? 255 : 0);
-        texture.pixels.push_back(palette.is_painted(ic) ? 255 : 0);
-        texture.pixels.push_back(c.opaque() ? 255 : 0);
-        ++i;
-      }
-    }
+    DecodeTextures(p, palette_msb, palette_msb, nullptr, nullptr, &texture);
     return texture;
   }
+
+ private:
+  // Sizes an output image for 'DecodeTextures'. Returns its pixels, or null.
+  uint8_t* Prepare(Image8* im) const {
+    if (!im) return nullptr;
+    if (im->width != width || im->height != height || im->channels != 4) {
+      *im = Image8(width, height, 4);
+    }
+    return im->pixels.data();
+  }
+};
+
+// Images for converting a car, kept from car to car so that converting
+// thousands of them doesn't keep allocating and freeing the same buffers.
+//  - 'Local()' has one per thread; cars on other threads have their own.
+//  - Only for use within one conversion: whatever's in them is overwritten by
+//    the next.
+struct CarScratch {
+  CarObject::UvPalette uv_palette;
+  Image8 pixels = Image8(0, 0);   // See 'CarPix::Pixels'.
+  Image8 texture = Image8(0, 0);  // The outputs of 'CarPix::DecodeTextures'.
+  Image8 brake = Image8(0, 0);
+  Image8 flags = Image8(0, 0);
+
+  static CarScratch& Local() {
+    static thread_local CarScratch scratch;
+    return scratch;
+  }
 };
 
 std::ostream& operator<<(std::ostream& os, const CarPix::Header& h) {
@@ -4,10 +4,12 @@
 #ifndef GT2_EXTRACT_CAR_FROM_OBJ_H_
 #define GT2_EXTRACT_CAR_FROM_OBJ_H_
 
+#include <algorithm>
 #include <cmath>
-#include <map>
 #include <ostream>
+#include <queue>
 #include <set>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -202,7 +204,7 @@ inline void UpdateFromObj(const Obj& o, Model& m) {
 //  - Returned values are the number of pixels with the given color.
 //  - 'face_index' is written to each affected pixel of 'face_indices' (over-
 //    writing any data which already exists there.)
-inline std::map<Color16, uint16_t> ExtractFacePalette(
+inline ColorHistogram ExtractFacePalette(
     const TexFace& f, const Image8& tex, uint16_t face_index,
     Image<uint16_t>& face_indices) {
   CHECK_EQ(face_indices.width, tex.width);
@@ -233,7 +235,7 @@ inline std::map<Color16, uint16_t> ExtractFacePalette(
   if (f.is_quad()) face_indices.DrawTriangle(f.uv0, f.uv2, f.uv3, face_index);
 
   // Assign each pixel to the face's palette.
-  std::map<Color16, uint16_t> p;
+  static thread_local ColorCounter p;
   for (int y = lo.y; y <= hi.y; ++y) {
     const int x0 = y * tex.width;
     const int tx0 = y * tex.width * 4;
@@ -244,11 +246,11 @@ inline std::map<Color16, uint16_t> ExtractFacePalette(
       const uint8_t b = tex.pixels[x * 4 + tx0 + 2];
       const uint8_t a = tex.pixels[x * 4 + tx0 + 3];
       const auto color = RgbaToColor16(r, g, b, a);
-      ++p[color];
+      p.Add(color);
     }
   }
 
-  return p;
+  return p.Take();
 }
 
 // A palette, and its associated Model faces.
@@ -256,7 +258,7 @@ inline std::map<Color16, uint16_t> ExtractFacePalette(
 //  - TexQuad face indices start immediately after TexTri faces.
 struct PaletteData {
   // Color -> num_pixels.
-  std::map<Color16, uint16_t> colors;
+  ColorHistogram colors;
   // Face indices with this palette.
   std::unordered_set<uint16_t> face_index;
 };
@@ -275,24 +277,24 @@ struct TexturePaletteData {
 
 // Merges all the colors and faces from 'b' into 'a'.
 inline void PaletteDataUnion(PaletteData& a, const PaletteData& b) {
-  for (const auto& kv : b.colors) a.colors[kv.first] += kv.second;
+  a.colors.Merge(b.colors);
   for (const auto& f : b.face_index) a.face_index.insert(f);
 }
 
-// Extracts the color palette from 'tex' for each face of Model 'm'.
-inline TexturePaletteData ExtractFacePalettes(const Image8& tex,
-                                              const Model& m) {
+// Extracts the color palette from 'tex' for each face of Model 'm', into
+// 'out'. Reuses the memory of 'out.face_indices'.
+inline void ExtractFacePalettes(const Image8& tex, const Model& m,
+                                TexturePaletteData& out) {
   CHECK_EQ(tex.channels, 4);
 
   const int num_faces = m.tex_tris.size() + m.tex_quads.size();
 
-  TexturePaletteData out;
+  out.palettes.clear();
   out.palettes.resize(num_faces);
-  out.face_indices = Image16(tex.width, tex.height, /*channels=*/1);
+  out.face_indices.Reset(tex.width, tex.height, /*c=*/1);
   constexpr auto kInvalidFace = std::numeric_limits<uint16_t>::max();
-  for (int i = 0; i < out.face_indices.pixels.size(); ++i) {
-    out.face_indices.pixels[i] = kInvalidFace;
-  }
+  std::fill(out.face_indices.pixels.begin(), out.face_indices.pixels.end(),
+            kInvalidFace);
 
   // Make a palette per face.
   int face_index = 0;
@@ -311,7 +313,11 @@ inline TexturePaletteData ExtractFacePalettes(const Image8& tex,
     ++face_index;
   }
   CHECK_EQ(face_index, num_faces);
-
+}
+inline TexturePaletteData ExtractFacePalettes(const Image8& tex,
+                                              const Model& m) {
+  TexturePaletteData out;
+  ExtractFacePalettes(tex, m, out);
   return out;
 }
 
@@ -329,7 +335,7 @@ inline TexturePaletteData ExtractWheelPalette(const Image8& tex) {
   }
 
   // Hallucinate a face for the wheel.
-  TexFace f;
+  TexFace f = {};
   f.set_quad();
   f.uv0 = {0, 0};
   f.uv1 = {0, 48};
@@ -344,92 +350,193 @@ inline TexturePaletteData ExtractWheelPalette(const Image8& tex) {
   return out;
 }
 
+// Merges palettes cheapest pair first, for 'MergePalettes'.
+//  - Candidate pairs wait in a priority queue, keyed by the cost of merging
+//    them. After a merge only the pairs with the merged palette are scored
+//    again; entries about older versions of a palette are skipped when popped.
+//  - Each palette also keeps its colors as a bitset over all the distinct
+//    colors in play, so the size of a union is a popcount.
+//  - Merges that fit in 'max_colors' cost nothing in quality, and always go
+//    first, fewest new colors first. The others cost the square color
+//    distance between the palettes, and are quantized afterwards.
+class PaletteMerger {
+ public:
+  PaletteMerger(std::vector<PaletteData>& palettes, int max_colors,
+                Quantizer quantizer)
+      : palettes_(palettes), max_colors_(max_colors), quantizer_(quantizer) {
+    // Number the distinct colors.
+    for (const auto& p : palettes_) {
+      for (const auto& e : p.colors) colors_.push_back(e.color);
+    }
+    std::sort(colors_.begin(), colors_.end());
+    colors_.erase(std::unique(colors_.begin(), colors_.end()), colors_.end());
+    words_ = (colors_.size() + 63) / 64;
+
+    const int n = palettes_.size();
+    bits_.resize(n * words_);
+    version_.resize(n);
+    alive_.assign(n, true);
+    num_alive_ = n;
+    for (int i = 0; i < n; ++i) UpdateBits(i);
+  }
+
+  // Merges until no merge is free and at most 'max_palettes' are left.
+  void Run(int max_palettes) {
+    const int n = palettes_.size();
+    for (int a = 0; a < n; ++a) {
+      for (int b = a + 1; b < n; ++b) Push(a, b);
+    }
+    while (!queue_.empty()) {
+      const Candidate c = queue_.top();
+      queue_.pop();
+      if (!alive_[c.a] || !alive_[c.b]) continue;
+      if (c.version_a != version_[c.a] || c.version_b != version_[c.b]) {
+        continue;
+      }
+      if (c.cost >= kLossy && num_alive_ <= max_palettes) break;
+      Merge(c.a, c.b);
+    }
+
+    // Keep what's left.
+    std::vector<PaletteData> out;
+    out.reserve(num_alive_);
+    for (int i = 0; i < n; ++i) {
+      if (alive_[i]) out.push_back(std::move(palettes_[i]));
+    }
+    palettes_.swap(out);
+  }
+
+ private:
+  // Costs from here up lose colors.
+  static constexpr int64_t kLossy = int64_t(1) << 40;
+
+  struct Candidate {
+    int64_t cost;
+    int a;
+    int b;
+    uint32_t version_a;
+    uint32_t version_b;
+    // Cheapest first; ties go to the lowest indices.
+    bool operator>(const Candidate& c) const {
+      if (cost != c.cost) return cost > c.cost;
+      if (a != c.a) return a > c.a;
+      return b > c.b;
+    }
+  };
+
+  void UpdateBits(int i) {
+    uint64_t* bits = &bits_[i * words_];
+    std::fill(bits, bits + words_, 0);
+    for (const auto& e : palettes_[i].colors) {
+      const auto it =
+          std::lower_bound(colors_.begin(), colors_.end(), e.color);
+      CHECK(it != colors_.end() && *it == e.color);
+      const int k = it - colors_.begin();
+      bits[k / 64] |= uint64_t(1) << (k % 64);
+    }
+  }
+
+  int UnionSize(int a, int b) const {
+    const uint64_t* bits_a = &bits_[a * words_];
+    const uint64_t* bits_b = &bits_[b * words_];
+    int out = 0;
+    for (int w = 0; w < words_; ++w) {
+      out += __builtin_popcountll(bits_a[w] | bits_b[w]);
+    }
+    return out;
+  }
+
+  void Push(int a, int b) {
+    const int size_a = palettes_[a].colors.size();
+    const int size_b = palettes_[b].colors.size();
+    const int union_size = UnionSize(a, b);
+    int64_t cost;
+    if (union_size <= max_colors_) {
+      cost = int64_t(union_size - std::max(size_a, size_b)) << 20 | union_size;
+    } else {
+      cost = kLossy + ComputePaletteDist(palettes_[a].colors,
+                                         palettes_[b].colors).sum_sq_dist;
+    }
+    queue_.push({cost, a, b, version_[a], version_[b]});
+  }
+
+  // Merges 'b' into 'a', and scores the new 'a' against everyone else.
+  void Merge(int a, int b) {
+    PaletteDataUnion(palettes_[a], palettes_[b]);
+    if (palettes_[a].colors.size() > max_colors_) {
+      QuantizeColors(palettes_[a].colors, max_colors_, quantizer_);
+    }
+    CHECK_LE(palettes_[a].colors.size(), max_colors_);
+    UpdateBits(a);
+    ++version_[a];
+    alive_[b] = false;
+    palettes_[b] = PaletteData();
+    --num_alive_;
+    for (int k = 0; k < palettes_.size(); ++k) {
+      if (k == a || !alive_[k]) continue;
+      Push(std::min(a, k), std::max(a, k));
+    }
+  }
+
+  std::vector<PaletteData>& palettes_;
+  const int max_colors_;
+  const Quantizer quantizer_;
+  std::vector<Color16> colors_;  // Distinct colors, sorted.
+  int words_ = 0;                // Bitset words per palette.
+  std::vector<uint64_t> bits_;   // Colors of each palette.
+  std::vector<uint32_t> version_;
+  std::vector<bool> alive_;
+  int num_alive_ = 0;
+  std::priority_queue<Candidate, std::vector<Candidate>,
+                      std::greater<Candidate>>
+      queue_;
+};
+
 // Compresses and quantizes the palette data to fit constraints.
 //  - Result will contain no more than 'max_palettes' entries.
 //  - Each palette will contain no more than 'max_colors'.
 //  - Palettes with no faces are removed.
+//  - 'quantizer' picks the colors to keep when there are too many.
 inline void MergePalettes(std::vector<PaletteData>& palettes, int max_palettes,
-                          int max_colors) {
+                          int max_colors,
+                          Quantizer quantizer = Quantizer::kFarthest) {
   // Get rid of palettes that have no face.
-  std::sort(palettes.begin(), palettes.end(),
-            [](const PaletteData& a, const PaletteData& b) {
-              return a.face_index.size() > b.face_index.size();
-            });
-  while (!palettes.empty() && palettes.back().face_index.empty()) {
-    palettes.pop_back();
-  }
+  palettes.erase(std::remove_if(palettes.begin(), palettes.end(),
+                                [](const PaletteData& p) {
+                                  return p.face_index.empty();
+                                }),
+                 palettes.end());
 
   // Quantize each palette if it has too many colors.
-  for (auto& p : palettes) QuantizeColors(p.colors, max_colors);
-
-  // Sort by number of colors (largest first).
-  std::sort(palettes.begin(), palettes.end(),
-            [](const PaletteData& a, const PaletteData& b) {
-              return a.colors.size() > b.colors.size();
-            });
-
-  // Merge palettes which are exactly overlapping.
-  for (int i = 0; i < palettes.size(); ++i) {
-    auto& target = palettes[i];
-    for (int j = i + 1; j < palettes.size();) {
-      auto& source = palettes[j];
-      const PaletteDist dist = ComputePaletteDist(target.colors, source.colors);
-      if (dist.sum_sq_dist == 0) {
-        PaletteDataUnion(target, source);
-        CHECK_LE(target.colors.size(), max_colors);
-        std::swap(source, palettes.back());
-        palettes.pop_back();
-      } else {
-        ++j;
+  for (auto& p : palettes) QuantizeColors(p.colors, max_colors, quantizer);
+
+  // Faces often share exactly the same colors. Merge those up front, so the
+  // pairwise search below only sees distinct palettes.
+  {
+    std::unordered_map<std::string, int> seen;
+    std::vector<PaletteData> distinct;
+    for (auto& p : palettes) {
+      std::string key;
+      for (const auto& e : p.colors) {
+        key.append(reinterpret_cast<const char*>(&e.color), sizeof(e.color));
       }
-    }
-  }
-
-  // Merge palettes which can be merged without exceeding 'max_colors'.
-  for (int i = 0; i < palettes.size(); ++i) {
-    auto& target = palettes[i];
-    for (int j = i + 1; j < palettes.size();) {
-      auto& source = palettes[j];
-      const PaletteDist dist = ComputePaletteDist(target.colors, source.colors);
-      if (dist.union_size <= max_colors) {
-        PaletteDataUnion(target, source);
-        CHECK_LE(target.colors.size(), max_colors);
-        std::swap(source, palettes.back());
-        palettes.pop_back();
+      const auto inserted = seen.emplace(key, distinct.size());
+      if (inserted.second) {
+        distinct.push_back(std::move(p));
       } else {
-        ++j;
+        PaletteDataUnion(distinct[inserted.first->second], p);
       }
     }
+    palettes.swap(distinct);
   }
 
+  PaletteMerger(palettes, max_colors, quantizer).Run(max_palettes);
+
   // Sort by number of colors (largest first).
   std::sort(palettes.begin(), palettes.end(),
             [](const PaletteData& a, const PaletteData& b) {
               return a.colors.size() > b.colors.size();
             });
-
-  // Destructive: quantize colors until 'max_palettes' is satisfied.
-  for (int i = palettes.size() - 1; i >= max_palettes; --i) {
-    const auto& source = palettes[i];
-
-    int j_best = 0;
-    int64_t dist_best = kInt64Max;
-
-    // Find the best target palette.
-    for (int j = 0; j < i; ++j) {
-      const PaletteDist dist =
-          ComputePaletteDist(palettes[j].colors, source.colors);
-      if (dist.sum_sq_dist < dist_best) {
-        dist_best = dist.sum_sq_dist;
-        j_best = j;
-      }
-    }
-
-    // Merge and quantize.
-    PaletteDataUnion(palettes[j_best], source);
-    QuantizeColors(palettes[j_best].colors, max_colors);
-    palettes.pop_back();
-  }
 }
 
 inline void AssignPaletteIndicesToFaces(
@@ -489,8 +596,8 @@ inline void UpdateCarPixSubPalettes(
     const auto& p = palettes[i];
     CHECK_LE(p.colors.size(), 16);
     int j = 0;
-    for (const auto& kv : p.colors) {
-      cdp_palette.data[16 * (i0 + i) + j] = kv.first;
+    for (const auto& e : p.colors) {
+      cdp_palette.data[16 * (i0 + i) + j] = e.color;
       ++j;
     }
   }
@@ -543,14 +650,14 @@ inline void UpdateCarPixColorIndex(const Image8& texture,
     const uint16_t i_palette = it->second;
 
     // Find the palette.
-    const std::map<Color16, uint16_t>& colors = data.palettes[i_palette].colors;
+    const ColorHistogram& colors = data.palettes[i_palette].colors;
 
     // Scan the palette row to find the best matching color for this pixel.
     int c_best = 0;
     int64_t d_best = kInt64Max;
     int c = 0;
-    for (const auto& kv : colors) {
-      const int64_t d = ColorDistSq(color, kv.first);
+    for (const auto& e : colors) {
+      const int64_t d = ColorDistSq(color, e.color);
       if (d < d_best) {
         c_best = c;
         d_best = d;
@@ -4,8 +4,13 @@
 #ifndef GT2_EXTRACT_CAR_TO_OBJ_H_
 #define GT2_EXTRACT_CAR_TO_OBJ_H_
 
+#include <charconv>
 #include <cmath>
-#include <ostream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -24,8 +29,49 @@ struct ObjState {
   int i_uv = 1;
 };
 
+// Digits written after the decimal point for OBJ coordinates, by default.
+constexpr int kObjPrecision = 6;
+
+// Formats OBJ text into a single growable buffer.
+//  - Numbers go through std::to_chars: no locale, no virtual calls.
+//  - Floats are written with a fixed number of decimal places.
+//  - Clear() keeps the buffer, so one writer can be reused for many files.
+class ObjWriter {
+ public:
+  explicit ObjWriter(int precision = kObjPrecision) : precision_(precision) {
+    CHECK(precision >= 0 && precision <= 16, "Bad OBJ precision ", precision);
+  }
+
+  ObjWriter& operator<<(std::string_view s) {
+    out_.append(s);
+    return *this;
+  }
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic_v<T>, ObjWriter&> operator<<(T v) {
+    char buf[64];
+    std::to_chars_result r;
+    if constexpr (std::is_floating_point_v<T>) {
+      r = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::fixed,
+                        precision_);
+    } else {
+      r = std::to_chars(buf, buf + sizeof(buf), v);
+    }
+    CHECK(r.ec == std::errc(), "Failed to format ", v);
+    out_.append(buf, r.ptr - buf);
+    return *this;
+  }
+
+  // Text written so far.
+  std::string_view str() const { return out_; }
+  void Clear() { out_.clear(); }
+
+ private:
+  int precision_;
+  std::string out_;
+};
+
 // Rescales a model vertex and writes it to the stream.
-inline void WriteObjVert(std::ostream& os, const float scale,
+inline void WriteObjVert(ObjWriter& os, const float scale,
                          const Vec4<int16_t>& v) {
   // Cars are described in something like millimeters?
   const float k = scale;
@@ -33,12 +79,12 @@ inline void WriteObjVert(std::ostream& os, const float scale,
 }
 
 // Rescales a model normal and writes it to the stream.
-inline void WriteObjNorm(std::ostream& os, const Normal32& n) {
+inline void WriteObjNorm(ObjWriter& os, const Normal32& n) {
   os << "vn " << n.xf() << " " << n.yf() << " " << n.zf() << "\n";
 }
 
 // Extracts UVs from the given face and writes it to the OBJ.
-inline void WriteObjUvs(std::ostream& os, const TexFace& f) {
+inline void WriteObjUvs(ObjWriter& os, const TexFace& f) {
   constexpr float kX = 1.0 / 256.0;
   constexpr float kY = 1.0 / 224.0;
   constexpr float dX = 0.5 * kX;
@@ -53,7 +99,7 @@ inline void WriteObjUvs(std::ostream& os, const TexFace& f) {
 }
 
 // Writes a textured or untextured tri or quad into the stream.
-inline void WriteObjFace(std::ostream& os, const ObjState& s, const Face& f) {
+inline void WriteObjFace(ObjWriter& os, const ObjState& s, const Face& f) {
   // Function to write one face element (v/uv/n)
   const auto write = [&](int i) {
     os << " " << f.i_vert[i] + s.i_vert;
@@ -99,12 +145,11 @@ inline void TransferNormals(std::vector<TexFace>& faces) {
   }
 }
 
-// Writes a model to an OBJ file and updates the counts in 'state'.
-// Multiple models can be written correctly to the same stream if the ObjState
-// is reused between calls.
-inline void WriteObj(std::ostream& os, ObjState& state, const Model& m) {
-  const float scale = m.header.scale.to_meters();
-
+// Copies the textured faces of 'm' (a Model or ModelView), reordered and
+// patched to render properly on modern hardware.
+template <typename Lod>
+void PrepareTexFaces(const Lod& m, std::vector<TexFace>& tex_tris,
+                     std::vector<TexFace>& tex_quads) {
   // Lots of cars have decals with transparency applied to some of the faces.
   // We do some gymastics to get these to render properly on modern hardware.
 
@@ -113,8 +158,8 @@ inline void WriteObj(std::ostream& os, ObjState& state, const Model& m) {
   // always seem to come before the base paint faces in CDO/CNO files, so if we
   // reverse the face ordering, we can get the decals to render on top of
   // the base paint.
-  auto tex_tris = m.tex_tris;
-  auto tex_quads = m.tex_quads;
+  tex_tris.assign(m.tex_tris.begin(), m.tex_tris.end());
+  tex_quads.assign(m.tex_quads.begin(), m.tex_quads.end());
   std::reverse(std::begin(tex_tris), std::end(tex_tris));
   std::reverse(std::begin(tex_quads), std::end(tex_quads));
 
@@ -125,6 +170,17 @@ inline void WriteObj(std::ostream& os, ObjState& state, const Model& m) {
   // normals from the decal faces to the matching base-paint faces.
   TransferNormals(tex_tris);
   TransferNormals(tex_quads);
+}
+
+// Writes a model (a Model or ModelView) to an OBJ file and updates the counts
+// in 'state'. Multiple models can be written correctly to the same stream if
+// the ObjState is reused between calls.
+template <typename Lod>
+void WriteObj(ObjWriter& os, ObjState& state, const Lod& m) {
+  const float scale = m.header.scale.to_meters();
+
+  std::vector<TexFace> tex_tris, tex_quads;
+  PrepareTexFaces(m, tex_tris, tex_quads);
 
   // Write the OBJ vertex data (positions, normals, uvs).
   for (const auto& v : m.verts) WriteObjVert(os, scale, v);
@@ -168,57 +224,148 @@ inline void WriteObj(std::ostream& os, ObjState& state, const Model& m) {
   state.i_normal += m.normals.size();
 }
 
-// Writes the car object and pix files to an OBJ.
-inline void SaveObj(const CarObject& cdo, const CarPix& cdp,
-                    const std::string& path, const std::string& name,
-                    bool make_wheels) {
+// Which files to write for each car.
+enum class ExportProfile {
+  kMinimal,  // Models, MTL, manifest, and the first skin only.
+  kViewer,   // Plus every skin and its brake lights.
+  kDebug,    // Plus palettes, flags and the UV/pixel debugging images.
+  // Models, MTL, manifest, one index texture and a strip of every palette,
+  // for viewers that look colors up on the GPU. GLBs get every skin instead.
+  kGpu,
+};
+
+// Parses "minimal", "viewer", "debug" or "gpu".
+inline ExportProfile ExportProfileFromString(std::string_view s) {
+  if (s == "minimal") return ExportProfile::kMinimal;
+  if (s == "viewer") return ExportProfile::kViewer;
+  if (s == "debug") return ExportProfile::kDebug;
+  if (s == "gpu") return ExportProfile::kGpu;
+  FAIL("Unknown export profile '", s, "'. Try minimal, viewer, debug or gpu.");
+  return ExportProfile::kDebug;
+}
+
+// Settings for 'SaveObj' and 'SaveGlb'.
+struct ExportOptions {
+  // Decimal places for OBJ coordinates.
+  int precision = kObjPrecision;
+  // Writes the palette, texture and brake light PNGs with indexed color.
+  bool indexed_png = false;
+  // Which files to write. Everything, by default.
+  ExportProfile profile = ExportProfile::kDebug;
+  // Texels to grow textures by around their UVs.
+  int padding = 1;
+
+  // Number of skins (textures, one per palette) to write.
+  int num_skins(const CarPix& cdp) const {
+    const int n = cdp.palettes.size();
+    return profile == ExportProfile::kMinimal ? std::min(n, 1) : n;
+  }
+  bool brake_lights() const {
+    return profile == ExportProfile::kViewer || debug_images();
+  }
+  bool debug_images() const { return profile == ExportProfile::kDebug; }
+  // An index texture and palette strip instead of one texture per skin.
+  bool palette_strip() const { return profile == ExportProfile::kGpu; }
+};
+
+// Builds the four wheels of a car.
+inline std::vector<Model> MakeWheels(const CarObject::Header& header) {
+  std::vector<Model> wheels;
+  wheels.reserve(4);
+  for (int i = 0; i < 4; ++i) {
+    wheels.push_back({});
+    MakeWheel(header.wheel_pos[i], header.wheel_size[i / 2], wheels.back());
+  }
+  return wheels;
+}
+
+// Receives each file 'ExportObj' makes: its name, and its contents.
+using ExportSink =
+    std::function<void(const std::string& name, std::string_view data)>;
+
+// Converts the car object (a CarObject or CarObjectView) and pix files to OBJ
+// (plus MTL, PNGs and o.json), handing every file to 'sink' instead of
+// writing it.
+template <typename Object>
+void ExportObj(const Object& cdo, const CarPix& cdp, const std::string& name,
+               bool make_wheels, const ExportOptions& options,
+               const ExportSink& sink) {
   CHECK(EndsWith(name, ".cd") || EndsWith(name, ".cn"),
         "Output name should end with '.cd' or '.cn' to avoid name collisions "
         "between models.",
         name);
+  TraceScope trace("ExportObj", name);
 
-  const Image pixels = cdp.Pixels();
-  const CarObject::UvPalette uv_palette = cdo.DrawUvPalette();
+  // The images are this thread's, reused from the last car.
+  CarScratch& scratch = CarScratch::Local();
+  CarObject::UvPalette& uv_palette = scratch.uv_palette;
+  cdo.DrawUvPalette(options.padding, uv_palette);
+  const bool debug = options.debug_images();
+  const bool strip = options.palette_strip();
+  const int num_skins = options.num_skins(cdp);
 
   // Debugging images.
-  Save(pixels.ToPng(), path + name + "p.pixels.png");
-  Save(uv_palette.index.ToPng(), path + name + "p.uv_palette.png");
-  Save(uv_palette.mask.ToPng(), path + name + "p.uv_palette_mask.png");
-
-  // Save the textures using each of the palettes.
-  for (int i = 0; i < cdp.palettes.size(); ++i) {
-    const std::string texture_path = StrCat(path, name, "p.", i);
-
-    const Image palette = cdp.PaletteImage(i);
-    Save(palette.ToPng(), texture_path + ".palette.png");
+  if (debug) {
+    TraceScope trace("ExportObj debug images");
+    cdp.Pixels(scratch.pixels);
+    sink(name + "p.pixels.png", scratch.pixels.ToPng());
+    sink(name + "p.uv_palette.png", uv_palette.index.ToPng());
+    sink(name + "p.uv_palette_mask.png", uv_palette.mask.ToPng());
+  }
 
-    const Image flags = cdp.FlagDebugTexture(i, uv_palette.index);
-    Save(flags.ToPng(), texture_path + ".flags.png");
+  // The viewer decodes skins itself from these.
+  if (strip) {
+    TraceScope trace("ExportObj palette strip");
+    const Image8 index = cdp.IndexTexture(uv_palette.index, uv_palette.mask,
+                                          &uv_palette.dilation);
+    sink(name + "p.index.png", index.ToPng());
+    sink(name + "p.strip.png", cdp.PaletteStrip().ToPng(options.indexed_png));
+  }
 
-    const Image texture = cdp.Texture(i, uv_palette.index, uv_palette.mask);
-    Save(texture.ToPng(), texture_path + ".png");
+  // Save the textures using each of the palettes. Only what the profile asks
+  // for is decoded.
+  Image8& texture = scratch.texture;
+  Image8& brake_texture = scratch.brake;
+  Image8& flags = scratch.flags;
+  for (int i = 0; !strip && i < num_skins; ++i) {
+    const std::string texture_name = StrCat(name, "p.", i);
+    TraceScope trace("ExportObj skin", texture_name);
+
+    if (debug) {
+      const Image palette = cdp.PaletteImage(i);
+      sink(texture_name + ".palette.png", palette.ToPng(options.indexed_png));
+    }
 
-    const Image brake_texture = cdp.BrakeLightTexture(i, uv_palette.index);
-    Save(brake_texture.ToPng(), texture_path + ".brake.png");
+    // All the textures come from one pass over the pixels.
+    cdp.DecodeTextures(i, uv_palette.index, uv_palette.mask, &texture,
+                       options.brake_lights() ? &brake_texture : nullptr,
+                       debug ? &flags : nullptr, &uv_palette.dilation);
+    if (debug) sink(texture_name + ".flags.png", flags.ToPng());
+    sink(texture_name + ".png", texture.ToPng(options.indexed_png));
+    if (options.brake_lights()) {
+      sink(texture_name + ".brake.png",
+           brake_texture.ToPng(options.indexed_png));
+    }
   }
 
   {  // Write the MTL file.
-    std::fstream f;
-    f.open(path + name + "o.mtl", std::ios::out);
+    TraceScope trace("ExportObj mtl");
+    const std::string map = name + (strip ? "p.index.png" : "p.0.png");
+    std::ostringstream f;
     f << "newmtl Reflective\n";
     f << "  Ka 0.0 0.0 0.0\n";
     f << "  Kd 1.0 1.0 1.0\n";
     f << "  Ks 1.0 1.0 1.0\n";
     f << "  illum 3\n";
     f << "  Ns 5000.0\n";
-    f << "  map_Kd " << name + "p.0.png\n";
+    f << "  map_Kd " << map << "\n";
     f << "\n";
     f << "newmtl Diffuse\n";
     f << "  Ka 0.0 0.0 0.0\n";
     f << "  Kd 1.0 1.0 1.0\n";
     f << "  Ks 0.0 0.0 0.0\n";
     f << "  illum 1\n";
-    f << "  map_Kd " << name + "p.0.png\n";
+    f << "  map_Kd " << map << "\n";
     f << "\n";
     f << "newmtl Untextured\n";
     f << "  Ka 0.0 0.0 0.0\n";
@@ -226,41 +373,412 @@ inline void SaveObj(const CarObject& cdo, const CarPix& cdp,
     f << "  Ks 0.0 0.0 0.0\n";
     f << "  illum 1\n";
     f << "\n";
+    sink(name + "o.mtl", f.str());
+  }
+
+  // Make some wheels.
+  std::vector<Model> wheels;
+  if (make_wheels) wheels = MakeWheels(cdo.header);
+
+  // Write an OBJ file for each LOD, in one write.
+  ObjWriter obj(options.precision);
+  std::vector<size_t> lod_sizes;
+  for (int i = 0; i < cdo.num_lods; ++i) {
+    TraceScope trace("ExportObj obj");
+    obj.Clear();
+    obj << "mtllib " << name << "o.mtl\n";
+
+    ObjState state;
+    WriteObj(obj, state, cdo.lods[i]);
+    for (const auto& w : wheels) WriteObj(obj, state, w);
+    sink(StrCat(name, "o.", i, ".obj"), obj.str());
+    lod_sizes.push_back(obj.str().size());
   }
 
   {  // Write the JSON manifest (this is read by the three.js viewer).
-    std::fstream f;
-    f.open(path + name + "o.json", std::ios::out);
+    TraceScope trace("ExportObj json");
+    // OBJ sizes in bytes let the viewer plan which LODs to stream.
+    std::ostringstream f;
     f << "{\n";
     f << "  \"lods\": " << cdo.num_lods << ",\n";
-    f << "  \"palettes\": " << cdp.palettes.size() << "\n";
+    f << "  \"lod_sizes\": [";
+    for (int i = 0; i < lod_sizes.size(); ++i) {
+      f << (i > 0 ? ", " : "") << lod_sizes[i];
+    }
+    f << "],\n";
+    f << "  \"palettes\": " << num_skins << (strip ? ",\n" : "\n");
+    if (strip) f << "  \"palette_strip\": true\n";
     f << "}\n";
+    sink(name + "o.json", f.str());
   }
 
-  // Make some wheels.
-  std::vector<Model> wheels;
-  if (make_wheels) {
-    wheels.reserve(4);
-    for (int i = 0; i < 4; ++i) {
-      wheels.push_back({});
-      MakeWheel(cdo.header.wheel_pos[i], cdo.header.wheel_size[i / 2],
-                wheels.back());
+  // TODO(commongear): write the shadow to the OBJ.
+}
+
+// Writes the car object and pix files to an OBJ, in 'path'.
+template <typename Object>
+void SaveObj(const Object& cdo, const CarPix& cdp, const std::string& path,
+             const std::string& name, bool make_wheels,
+             const ExportOptions& options = {}) {
+  ExportObj(cdo, cdp, name, make_wheels, options,
+            [&path](const std::string& file, std::string_view data) {
+              Save(data, path + file);
+            });
+}
+
+// Renames a file that 'ExportObj' made for car 'from' to what it would have
+// made for car 'to'. Only the OBJs and MTL mention the name; the rest of the
+// files are the same for both.
+inline std::string RenameObjExport(std::string_view data,
+                                   const std::string& from,
+                                   const std::string& to) {
+  std::string out(data);
+  for (const std::string_view key : {"mtllib ", "map_Kd "}) {
+    const std::string find = StrCat(key, from);
+    const std::string replace = StrCat(key, to);
+    for (size_t i = 0; (i = out.find(find, i)) != std::string::npos;
+         i += replace.size()) {
+      out.replace(i, find.size(), replace);
+    }
+  }
+  return out;
+}
+
+// Output formats for converted cars.
+enum class CarFormat { kObj, kGlb };
+
+// Materials in the GLB, in the same order as the OBJ's MTL.
+constexpr int kGlbUntextured = 0;
+constexpr int kGlbDiffuse = 1;
+constexpr int kGlbReflective = 2;
+
+// Vertex data of one glTF primitive: the faces that share a material, and
+// either all have normals or all don't.
+struct GlbPrimitive {
+  int material = kGlbUntextured;
+  bool has_normals = false;
+  std::vector<float> positions;  // xyz.
+  std::vector<float> normals;    // xyz, if 'has_normals'.
+  std::vector<float> uvs;        // uv, if textured.
+  std::vector<uint32_t> indices;
+  // glTF has one index per vertex, so each distinct (vertex, normal, uv) that
+  // the faces use becomes a vertex.
+  std::unordered_map<uint64_t, uint32_t> vertex_ids;
+
+  bool textured() const { return material != kGlbUntextured; }
+  int64_t num_vertices() const { return positions.size() / 3; }
+
+  // Adds corner 'i' of face 'f' from model 'm'. Shared corners are reused.
+  template <typename Lod>
+  void AddCorner(const Lod& m, float scale, const Face& f, int i,
+                 const Vec2<uint8_t>* uv) {
+    const uint8_t i_vert = f.i_vert[i];
+    const uint16_t i_normal = (has_normals ? f.i_normal(i) : 0);
+    const uint64_t key = i_vert | (uint64_t{i_normal} << 8) |
+                         (uv ? (uint64_t{uv->x} << 24 | uint64_t{uv->y} << 32)
+                             : 0);
+    const auto [it, added] = vertex_ids.try_emplace(key, num_vertices());
+    indices.push_back(it->second);
+    if (!added) return;
+
+    CHECK_LT(i_vert, m.verts.size());
+    const Vec4<int16_t> v = m.verts[i_vert];
+    positions.insert(positions.end(), {scale * v.x, scale * v.y, scale * v.z});
+    if (has_normals) {
+      CHECK_LT(i_normal, m.normals.size());
+      const Normal32 n = m.normals[i_normal];
+      // glTF wants unit normals; ours are only roughly so.
+      const float len = n.lenf();
+      const float k = (len > 0 ? 1.f / len : 0.f);
+      normals.insert(normals.end(), {k * n.xf(), k * n.yf(), k * n.zf()});
+    }
+    if (uv) {
+      // Same texel centers as the OBJ, but glTF's V axis points down.
+      constexpr float kX = 1.0 / 256.0;
+      constexpr float kY = 1.0 / 224.0;
+      uvs.insert(uvs.end(), {kX * uv->x + 0.5f * kX, kY * uv->y + 0.5f * kY});
     }
   }
 
-  // Write an OBJ file for each LOD.
-  for (int i = 0; i < cdo.num_lods; ++i) {
-    const std::string lod_name = StrCat(path, name, "o.", i, ".obj");
+  // Adds a tri or quad (as two tris). 'uvs' is null for untextured faces.
+  template <typename Lod>
+  void AddFace(const Lod& m, float scale, const Face& f,
+               const Vec2<uint8_t>* const* uvs) {
+    const auto corner = [&](int i) {
+      AddCorner(m, scale, f, i, uvs ? uvs[i] : nullptr);
+    };
+    corner(0);
+    corner(1);
+    corner(2);
+    if (f.is_quad()) {
+      corner(0);
+      corner(2);
+      corner(3);
+    }
+  }
+};
 
-    std::fstream f(lod_name, std::ios::out | std::ios::binary);
-    f << "mtllib " << name + "o.mtl\n";
+// The primitives of one GLB mesh.
+struct GlbMesh {
+  std::vector<GlbPrimitive> primitives;
 
-    ObjState state;
-    WriteObj(f, state, cdo.lods[i]);
-    for (const auto& w : wheels) WriteObj(f, state, w);
+  GlbPrimitive& Primitive(int material, bool has_normals) {
+    for (auto& p : primitives) {
+      if (p.material == material && p.has_normals == has_normals) return p;
+    }
+    primitives.push_back({});
+    primitives.back().material = material;
+    primitives.back().has_normals = has_normals;
+    return primitives.back();
   }
 
-  // TODO(commongear): write the shadow to the OBJ.
+  // Adds the faces of 'm' (a Model or ModelView), grouped by material like
+  // WriteObj does.
+  template <typename Lod>
+  void AddModel(const Lod& m) {
+    const float scale = m.header.scale.to_meters();
+
+    std::vector<TexFace> tex_tris, tex_quads;
+    PrepareTexFaces(m, tex_tris, tex_quads);
+
+    for (const auto& f : m.tris) {
+      Primitive(kGlbUntextured, f.has_normals()).AddFace(m, scale, f, nullptr);
+    }
+    for (const auto& f : m.quads) {
+      Primitive(kGlbUntextured, f.has_normals()).AddFace(m, scale, f, nullptr);
+    }
+    for (const bool reflective : {false, true}) {
+      const int material = (reflective ? kGlbReflective : kGlbDiffuse);
+      for (const auto* faces : {&tex_tris, &tex_quads}) {
+        for (const auto& f : *faces) {
+          if (f.has_normals() != reflective) continue;
+          const Vec2<uint8_t>* uvs[4] = {&f.uv0, &f.uv1, &f.uv2, &f.uv3};
+          Primitive(material, reflective).AddFace(m, scale, f, uvs);
+        }
+      }
+    }
+  }
+};
+
+// Writes the JSON and binary chunks of a GLB file.
+class GlbWriter {
+ public:
+  // Appends 'data' to the binary chunk as a new buffer view. Returns its index.
+  int AddView(std::string_view data, int target = 0) {
+    while (bin_.size() % 4) bin_.push_back('\0');
+    Item(views_, StrCat("{\"buffer\":0,\"byteOffset\":", bin_.size(),
+                        ",\"byteLength\":", data.size()) +
+                     (target ? StrCat(",\"target\":", target) : "") + "}");
+    bin_.append(data);
+    return num_views_++;
+  }
+  template <typename T>
+  int AddView(const std::vector<T>& v, int target) {
+    return AddView(std::string_view(reinterpret_cast<const char*>(v.data()),
+                                    v.size() * sizeof(T)),
+                   target);
+  }
+
+  // Adds an accessor of 'n' elements of 'type' (e.g. "VEC3"). Returns its
+  // index.
+  int AddAccessor(int view, int component_type, int64_t n,
+                  std::string_view type, std::string_view extra = "") {
+    Item(accessors_, StrCat("{\"bufferView\":", view, ",\"componentType\":",
+                            component_type, ",\"count\":", n, ",\"type\":\"",
+                            type, "\"", extra, "}"));
+    return num_accessors_++;
+  }
+
+  // Adds an accessor for float data, with the min/max glTF needs for
+  // positions.
+  int AddFloats(const std::vector<float>& v, int size, std::string_view type,
+                bool bounds) {
+    const int view = AddView(v, kArrayBuffer);
+    const int64_t n = v.size() / size;
+    std::string extra;
+    if (bounds && n > 0) {
+      std::vector<float> lo(v.begin(), v.begin() + size), hi = lo;
+      for (int64_t i = 0; i < n; ++i) {
+        for (int j = 0; j < size; ++j) {
+          lo[j] = std::min(lo[j], v[i * size + j]);
+          hi[j] = std::max(hi[j], v[i * size + j]);
+        }
+      }
+      extra = ",\"min\":" + Floats(lo) + ",\"max\":" + Floats(hi);
+    }
+    return AddAccessor(view, kFloat, n, type, extra);
+  }
+
+  // Adds a mesh. Returns its index.
+  int AddMesh(const GlbMesh& mesh) {
+    std::string prims;
+    for (const auto& p : mesh.primitives) {
+      std::string attributes =
+          StrCat("\"POSITION\":", AddFloats(p.positions, 3, "VEC3", true));
+      if (p.has_normals) {
+        attributes +=
+            StrCat(",\"NORMAL\":", AddFloats(p.normals, 3, "VEC3", false));
+      }
+      if (p.textured()) {
+        attributes +=
+            StrCat(",\"TEXCOORD_0\":", AddFloats(p.uvs, 2, "VEC2", false));
+      }
+
+      // Small index types where they fit.
+      int indices = 0;
+      if (p.num_vertices() <= 0xFFFF) {
+        const std::vector<uint16_t> i16(p.indices.begin(), p.indices.end());
+        indices = AddAccessor(AddView(i16, kElementArrayBuffer), kUnsignedShort,
+                              i16.size(), "SCALAR");
+      } else {
+        indices = AddAccessor(AddView(p.indices, kElementArrayBuffer),
+                              kUnsignedInt, p.indices.size(), "SCALAR");
+      }
+      Item(prims, StrCat("{\"attributes\":{", attributes, "},\"indices\":",
+                         indices, ",\"material\":", p.material, "}"));
+    }
+    Item(meshes_, "{\"primitives\":[" + prims + "]}");
+    return num_meshes_++;
+  }
+
+  // Embeds a PNG. Returns the texture index.
+  int AddPng(std::string_view png) {
+    Item(images_, StrCat("{\"bufferView\":", AddView(png),
+                         ",\"mimeType\":\"image/png\"}"));
+    Item(textures_, StrCat("{\"sampler\":0,\"source\":", num_textures_, "}"));
+    return num_textures_++;
+  }
+
+  // Assembles the GLB, with 'nodes', 'scenes' and 'materials' as JSON arrays.
+  std::string Finish(std::string_view nodes, std::string_view scenes,
+                     std::string_view materials) const {
+    std::string json =
+        "{\"asset\":{\"version\":\"2.0\",\"generator\":\"gt2 extract\"},"
+        "\"scene\":0,\"scenes\":[" + std::string(scenes) +
+        "],\"nodes\":[" + std::string(nodes) +
+        "],\"meshes\":[" + meshes_ +
+        "],\"materials\":[" + std::string(materials) + "]";
+    if (num_textures_ > 0) {
+      // Nearest-neighbor filtering keeps the texels crisp.
+      json += ",\"samplers\":[{\"magFilter\":9728,\"minFilter\":9728}]"
+              ",\"images\":[" + images_ + "],\"textures\":[" + textures_ + "]";
+    }
+    json += ",\"accessors\":[" + accessors_ + "],\"bufferViews\":[" + views_ +
+            "],\"buffers\":[{\"byteLength\":" + std::to_string(bin_.size()) +
+            "}]}";
+    // Chunks are padded to 4 bytes: JSON with spaces, binary with zeros.
+    while (json.size() % 4) json.push_back(' ');
+    std::string bin = bin_;
+    while (bin.size() % 4) bin.push_back('\0');
+
+    std::string out;
+    out.reserve(28 + json.size() + bin.size());
+    const auto write_u32 = [&out](uint32_t v) {
+      out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    write_u32(0x46546C67);  // "glTF"
+    write_u32(2);           // Version.
+    write_u32(28 + json.size() + bin.size());
+    write_u32(json.size());
+    write_u32(0x4E4F534A);  // "JSON"
+    out.append(json);
+    write_u32(bin.size());
+    write_u32(0x004E4942);  // "BIN"
+    out.append(bin);
+    return out;
+  }
+
+ private:
+  static constexpr int kArrayBuffer = 34962;
+  static constexpr int kElementArrayBuffer = 34963;
+  static constexpr int kUnsignedShort = 5123;
+  static constexpr int kUnsignedInt = 5125;
+  static constexpr int kFloat = 5126;
+
+  // Appends an item to a comma-separated JSON list.
+  static void Item(std::string& list, std::string_view item) {
+    if (!list.empty()) list.push_back(',');
+    list.append(item);
+  }
+
+  // Formats floats as a JSON array, exactly (shortest round-trip).
+  static std::string Floats(const std::vector<float>& v) {
+    std::string out = "[";
+    for (int64_t i = 0; i < static_cast<int64_t>(v.size()); ++i) {
+      char buf[32];
+      const auto r = std::to_chars(buf, buf + sizeof(buf), v[i]);
+      if (i > 0) out.push_back(',');
+      out.append(buf, r.ptr - buf);
+    }
+    return out + "]";
+  }
+
+  std::string bin_;
+  std::string views_, accessors_, meshes_, images_, textures_;
+  int num_views_ = 0, num_accessors_ = 0, num_meshes_ = 0, num_textures_ = 0;
+};
+
+// Writes the car object and pix files to one binary glTF (GLB).
+//  - Each LOD is a node with its own mesh, and its own scene. Scene 0 (the
+//    default) shows LOD 0.
+//  - The textures for each palette (or just the first, for the minimal
+//    profile) are embedded in the file. Materials use the first; the others
+//    are there to swap in.
+template <typename Object>
+void SaveGlb(const Object& cdo, const CarPix& cdp, const std::string& path,
+             const std::string& name, bool make_wheels,
+             const ExportOptions& options = {}) {
+  CHECK(EndsWith(name, ".cd") || EndsWith(name, ".cn"),
+        "Output name should end with '.cd' or '.cn' to avoid name collisions "
+        "between models.",
+        name);
+
+  GlbWriter glb;
+
+  // Embed the textures, decoded into this thread's images.
+  CarScratch& scratch = CarScratch::Local();
+  CarObject::UvPalette& uv_palette = scratch.uv_palette;
+  cdo.DrawUvPalette(options.padding, uv_palette);
+  for (int i = 0; i < options.num_skins(cdp); ++i) {
+    cdp.DecodeTextures(i, uv_palette.index, uv_palette.mask, &scratch.texture,
+                       nullptr, nullptr, &uv_palette.dilation);
+    glb.AddPng(scratch.texture.ToPng(options.indexed_png));
+  }
+
+  // Materials, in the order of the kGlb* constants. Like the viewer, the
+  // textured ones cut out transparent texels.
+  const std::string texture =
+      (cdp.palettes.empty() ? "" : "\"baseColorTexture\":{\"index\":0},");
+  const std::string materials =
+      "{\"name\":\"Untextured\",\"pbrMetallicRoughness\":{"
+      "\"baseColorFactor\":[0,0,0,1],\"metallicFactor\":0}},"
+      "{\"name\":\"Diffuse\",\"pbrMetallicRoughness\":{" + texture +
+      "\"metallicFactor\":0},\"alphaMode\":\"MASK\",\"alphaCutoff\":0.005},"
+      "{\"name\":\"Reflective\",\"pbrMetallicRoughness\":{" + texture +
+      "\"metallicFactor\":0,\"roughnessFactor\":0.2},"
+      "\"alphaMode\":\"MASK\",\"alphaCutoff\":0.005}";
+
+  // Make some wheels.
+  std::vector<Model> wheels;
+  if (make_wheels) wheels = MakeWheels(cdo.header);
+
+  // One mesh per LOD, wheels included.
+  std::string nodes, scenes;
+  for (int i = 0; i < cdo.num_lods; ++i) {
+    GlbMesh mesh;
+    mesh.AddModel(cdo.lods[i]);
+    for (const auto& w : wheels) mesh.AddModel(w);
+
+    const std::string sep = (i > 0 ? "," : "");
+    nodes += sep + StrCat("{\"name\":\"", name, "o.", i, "\"");
+    if (!mesh.primitives.empty()) {
+      nodes += StrCat(",\"mesh\":", glb.AddMesh(mesh));
+    }
+    nodes += "}";
+    scenes += sep + StrCat("{\"nodes\":[", i, "]}");
+  }
+
+  Save(glb.Finish(nodes, scenes, materials), path + name + "o.glb");
 }
 
 }  // namespace gt2
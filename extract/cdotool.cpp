@@ -5,6 +5,7 @@
 #include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
@@ -14,9 +15,14 @@
 #include "car.h"
 #include "car_from_obj.h"
 #include "car_to_obj.h"
+#include "util/args.h"
 #include "util/color.h"
+#include "util/gzip.h"
 #include "util/io.h"
+#include "util/json.h"
 #include "util/obj.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 
 namespace miniz {
 #include "3p/miniz/miniz.c"
@@ -28,11 +34,43 @@ namespace miniz {
 using namespace gt2;
 
 static constexpr char kUsage[] =
-    "Usage:  cdotool command [args...]\n"
-    "  command:      [getobjs, getobjs-nowheels, packcdo, packcno]\n"
+    "Usage:  cdotool command [args...] [options...]\n"
+    "  command:      [getobjs, getobjs-nowheels, getglb, packcdo, packcno,\n"
+    "                packbatch]\n"
     "                details below\n"
     "  args...:      command arguments; details below\n"
     "\n"
+    "Options:\n"
+    "  -j N\n"
+    "    Threads for 'packcdo' to convert LODs on (default 3, one per LOD),\n"
+    "    or for 'packbatch' to convert cars on.\n"
+    "  --force\n"
+    "    Makes 'packbatch' convert every car, changed or not.\n"
+    "  --indexed-png\n"
+    "    Writes the palette, texture and brake light PNGs with indexed color\n"
+    "    (smaller files, same pixels).\n"
+    "  --profile minimal|viewer|debug|gpu\n"
+    "    Which files 'getobjs' and 'getglb' write (default debug).\n"
+    "      minimal:  models, materials, o.json and the first skin\n"
+    "      viewer:   plus every skin and its brake lights\n"
+    "      debug:    plus palettes, flags and UV debugging images\n"
+    "      gpu:      models, materials, o.json, an index texture and a strip\n"
+    "                of every palette, for the viewer to decode on the GPU\n"
+    "  --quantizer farthest|median-cut\n"
+    "    How 'packcdo' reduces palettes to 16 colors (default farthest).\n"
+    "      farthest:    greedy farthest-point selection\n"
+    "      median-cut:  weighted median cut; faster on large textures, and\n"
+    "                   favors the colors covering the most pixels\n"
+    "  --padding N\n"
+    "    Texels to grow textures by around their UVs, which hides seams\n"
+    "    (default 1).\n"
+    "  --stats\n"
+    "    Prints where the time went when the command finishes: time per stage,\n"
+    "    and bytes read, inflated and written per thread and per file.\n"
+    "  --trace path\n"
+    "    Writes the same as a Chrome trace, for chrome://tracing or\n"
+    "    ui.perfetto.dev.\n"
+    "\n"
     "Commands:\n"
     "  getobjs path-to-cdo output-path\n"
     "    Converts a CDO/CNO to several OBJs (one for each LOD), MTL and PNGs.\n"
@@ -40,6 +78,9 @@ static constexpr char kUsage[] =
     "    output-path:  folder in which to store the OBJ files\n"
     "  getobjs-nowheels path-to-cdo output-path\n"
     "    Same as above, but doesn't build wheels for the model.\n"
+    "  getglb path-to-cdo output-path\n"
+    "    Converts a CDO/CNO to one binary glTF (GLB) with every LOD and the\n"
+    "    textures inside.\n"
     "  packcdo path-to-base-cdo path-to-obj output-path\n"
     "    Converts an OBJ and supporting files to a CDO/CDP\n"
     "    path-to-base-cdo:  A CDO or CNO file to use as the base. There are\n"
@@ -49,13 +90,23 @@ static constexpr char kUsage[] =
     "    path-to-obj:       An OBJ file and supporting files to convert.\n"
     "    output-path:       Folder in which to store the CDO/CDP files.\n"
     "  packcno path-to-base-cdo path-to-obj output-path\n"
-    "    Same as above, but outputs a .CNO file.\n";
+    "    Same as above, but outputs a .CNO file.\n"
+    "  packbatch path-to-manifest\n"
+    "    Runs 'packcdo' for many cars in one go, skipping those whose inputs\n"
+    "    haven't changed since the last run (noted in <manifest>.state).\n"
+    "    path-to-manifest:  JSON list of jobs, with paths relative to it:\n"
+    "      {\"jobs\": [{\"base\": \"base.cdo\",\n"
+    "                  \"obj\": \"car/car.cdo.0.obj\",\n"
+    "                  \"out\": \"build\",\n"
+    "                  \"night\": false}, ...]}\n"
+    "      'night' (optional) makes a CNO/CNP instead.\n";
 
 // Prints the usage message.
 void PrintUsage() { std::cerr << kUsage << std::endl; }
 
-// Converts a CDO/CDP to OBJ.
-void GetObjs(std::string cdo_path, std::string out_path, bool make_wheels) {
+// Converts a CDO/CDP to OBJ (or GLB).
+void GetObjs(std::string cdo_path, std::string out_path, bool make_wheels,
+             CarFormat format, const ExportOptions& options) {
   CHECK(EndsWith(cdo_path, ".cdo") || EndsWith(cdo_path, ".cno"),
         "Input must be a .cdo/.cno file: ", cdo_path);
 
@@ -67,11 +118,13 @@ void GetObjs(std::string cdo_path, std::string out_path, bool make_wheels) {
   CHECK(std::filesystem::exists(cdp_path), cdp_path);
 
   // Read the object and texture data.
-  FileInStream cdo_file(cdo_path);
+  TraceScope trace("GetObjs", cdo_path);
+  const std::string cdo_data = Load(cdo_path);
   FileInStream cdp_file(cdp_path);
 
-  // Parse the files.
-  const CarObject cdo = CarObject::FromStream(cdo_file);
+  // Parse the files. The models are only read, so view them in place.
+  ViewInStream cdo_file(cdo_data);
+  const CarObjectView cdo = CarObjectView::FromStream(cdo_file);
   const CarPix cdp = CarPix::FromStream(cdp_file);
 
   // Craft the output file base name.
@@ -79,20 +132,37 @@ void GetObjs(std::string cdo_path, std::string out_path, bool make_wheels) {
       std::filesystem::path(base_path).filename().generic_string();
 
   // Write the OBJ data to the output path.
-  SaveObj(cdo, cdp, out_path, out_name, make_wheels);
-  std::cout << "Saved OBJ " << out_path + out_name + "..." << std::endl;
+  if (format == CarFormat::kGlb) {
+    SaveGlb(cdo, cdp, out_path, out_name, make_wheels, options);
+    std::cout << "Saved GLB " << out_path + out_name + "o.glb" << std::endl;
+  } else {
+    SaveObj(cdo, cdp, out_path, out_name, make_wheels, options);
+    std::cout << "Saved OBJ " << out_path + out_name + "..." << std::endl;
+  }
 }
 
-// Converts a set of OBJs and PNGs to CDO/CDP.
-void PackCdo(const std::string& base_cdo_path, std::string obj_path,
-             std::string out_path, bool is_day) {
+// The files one 'packcdo' conversion reads and writes.
+struct PackPaths {
+  std::string base_cdo_path;
+  std::vector<std::string> obj_paths;  // One for each LOD found, in order.
+  std::string tex_path;
+  std::string out_cdo_path;
+  std::string out_cdp_path;
+};
+
+// Finds the files for converting 'obj_path' (and the LODs next to it) into
+// the folder 'out_path'.
+PackPaths FindPackPaths(const std::string& base_cdo_path,
+                        const std::string& obj_path, std::string out_path,
+                        bool is_day, std::ostream& log) {
   CHECK(EndsWith(base_cdo_path, ".cdo") || EndsWith(base_cdo_path, ".cno"),
         "Base must be a .cdo/.cno file: ", base_cdo_path);
   CHECK(EndsWith(obj_path, ".obj"), "Input must be a .obj file: ", obj_path);
 
   // Sanitize the output path.
   out_path = std::filesystem::path(out_path).parent_path().generic_string();
-  std::cout << "PARENT PATH " << out_path << std::endl;
+  log << "PARENT PATH " << out_path << std::endl;
+  if (!out_path.empty()) out_path += "/";
 
   // Create paths for everything.
   const std::filesystem::path obj_fspath(obj_path);
@@ -113,30 +183,49 @@ void PackCdo(const std::string& base_cdo_path, std::string obj_path,
   CHECK(std::filesystem::exists(obj_path), "Not found:", obj_path);
   CHECK(std::filesystem::exists(tex_path), "Not found:", tex_path);
 
+  PackPaths out;
+  out.base_cdo_path = base_cdo_path;
+  out.tex_path = tex_path;
+
   // Create paths for each LOD.
-  std::vector<std::string> obj_paths = {obj_path};
+  out.obj_paths = {obj_path};
   for (int i = 1; i <= 2; ++i) {
     std::stringstream s;
     s << obj_name << "." << i << ".obj";
     const std::string lod_path = s.str();
     if (std::filesystem::exists(lod_path)) {
-      obj_paths.push_back(lod_path);
+      out.obj_paths.push_back(lod_path);
     } else {
-      std::cout << "LOD " << i << " file doesn't exist: '" << lod_path
-                << "'" << std::endl;
+      log << "LOD " << i << " file doesn't exist: '" << lod_path << "'"
+          << std::endl;
     }
   }
 
-  // Read the base object.
-  FileInStream base_cdo_file(base_cdo_path);
-  CarObject cdo = CarObject::FromStream(base_cdo_file);
+  // Both outputs drop the '.cdo'/'.cno' of the OBJ's name, if it has one, so
+  // the extensions match 'is_day'.
+  std::string out_stem = out_path + obj_stem;
+  if (EndsWith(out_stem, ".cdo") || EndsWith(out_stem, ".cno")) {
+    out_stem.resize(out_stem.size() - 4);
+  }
+  out.out_cdp_path = out_stem + (is_day ? ".cdp" : ".cnp");
+  out.out_cdo_path = out_stem + (is_day ? ".cdo" : ".cno");
+  return out;
+}
+
+// Converts a set of OBJs and PNGs to CDO/CDP, starting from the base 'cdo'.
+//  - LODs are converted on 'pool'; see below.
+//  - Progress goes to 'log', and warnings about the inputs to 'warn'.
+void PackCdo(const PackPaths& paths, CarObject cdo, Quantizer quantizer,
+             ThreadPool& pool, std::ostream& log, std::ostream& warn) {
+  TraceScope trace("PackCdo", paths.out_cdo_path);
+  const std::vector<std::string>& obj_paths = paths.obj_paths;
   CHECK_GT(cdo.lods.size(), 0);
 
   // Read the texture.
-  const std::string png_data = Load(tex_path);
+  const std::string png_data = Load(paths.tex_path);
   Image texture = Image8::FromPng(png_data);
-  std::cout << "Loaded " << tex_path << " " << texture.width << " x "
-            << texture.height << "\n";
+  log << "Loaded " << paths.tex_path << " " << texture.width << " x "
+      << texture.height << "\n";
 
   // Init the CDP with a cleared palette and 8bpp data.
   CarPix cdp = InitCarPix();
@@ -147,15 +236,18 @@ void PackCdo(const std::string& base_cdo_path, std::string obj_path,
   Image8 color_index(texture.width, texture.height, 1);
   Image8 color_mask(texture.width, texture.height, 1);
 
-  // Extract and update the palette and data from the wheel area (48 x 48 px).
-  TexturePaletteData wheel_texpal = ExtractWheelPalette(texture);
-  CHECK_EQ(wheel_texpal.palettes.size(), 1);
-  QuantizeColors(wheel_texpal.palettes[0].colors, /*max_colors=*/16);
+  {  // Extract and update the palette and data from the wheel (48 x 48 px).
+    TraceScope trace("PackCdo wheel");
+    TexturePaletteData wheel_texpal = ExtractWheelPalette(texture);
+    CHECK_EQ(wheel_texpal.palettes.size(), 1);
+    QuantizeColors(wheel_texpal.palettes[0].colors, /*max_colors=*/16,
+                   quantizer);
 
-  // Update the 0th sub-palette of the 0th palette in the data for the wheel.
-  UpdateCarPixSubPalettes(wheel_texpal.palettes, /*first_palette_index=*/0,
-                          cdp.palettes[0]);
-  UpdateCarPixColorIndex(texture, wheel_texpal, color_index, color_mask);
+    // Update the 0th sub-palette of the 0th palette in the data for the wheel.
+    UpdateCarPixSubPalettes(wheel_texpal.palettes, /*first_palette_index=*/0,
+                            cdp.palettes[0]);
+    UpdateCarPixColorIndex(texture, wheel_texpal, color_index, color_mask);
+  }
 
   // TODO(commongear): read the brake light texture and palette.
 
@@ -163,25 +255,39 @@ void PackCdo(const std::string& base_cdo_path, std::string obj_path,
   for (auto& x : cdo.padding) x = 0;
   for (auto& x : cdo.unknown1) x = 0;
 
-  // Load the OBJ for each LOD.
-  int first_palette_index = 3;
-  for (int i = 0; i < 3; ++i) {
+  // Convert each LOD on its own thread; they only share the (read-only)
+  // texture. Logs are held back so they print in order.
+  struct Lod {
+    bool found = false;
+    Model model;
+    TexturePaletteData* texpal = nullptr;  // In 'texpals'.
+    std::stringstream log;
+    std::stringstream warnings;
+  };
+  std::vector<Lod> lods(3);
+  // Palettes are kept from car to car, a set per thread running PackCdo. The
+  // LODs use this thread's set, though they run on the pool's threads.
+  static thread_local std::vector<TexturePaletteData> texpals(lods.size());
+  for (int i = 0; i < lods.size(); ++i) lods[i].texpal = &texpals[i];
+  ParallelFor(pool, lods.size(), [&](int i) {
+    Lod& lod = lods[i];
     // If there is no OBJ for this lod, clear it.
     // We'd like to copy, but CDOs have a 20K limit.
     if (i >= obj_paths.size()) {
-      std::cout << "No LOD " << i << " obj found. Skipping." << std::endl;
-      cdo.lods[i] = Model();
-      continue;
+      lod.log << "No LOD " << i << " obj found. Skipping." << std::endl;
+      return;
     }
+    lod.found = true;
+    TraceScope trace("PackCdo LOD", obj_paths[i]);
 
     // Read the OBJ.
     const std::string obj_data = Load(obj_paths[i]);
-    Obj obj = Obj::FromString(obj_data);
-    std::cout << "Loaded " << obj_path << "\n";
-    std::cout << " verts " << obj.verts.size() << "\n";
-    std::cout << " norms " << obj.normals.size() << "\n";
-    std::cout << "   uvs " << obj.uvs.size() << "\n";
-    std::cout << " faces " << obj.faces.size() << std::endl;
+    Obj obj = Obj::FromString(obj_data, lod.warnings);
+    lod.log << "Loaded " << obj_paths[0] << "\n";
+    lod.log << " verts " << obj.verts.size() << "\n";
+    lod.log << " norms " << obj.normals.size() << "\n";
+    lod.log << "   uvs " << obj.uvs.size() << "\n";
+    lod.log << " faces " << obj.faces.size() << std::endl;
 
     // Check the OBJ.
     CHECK_LE(obj.verts.size(), 256, "CDO only supports 255 verts.");
@@ -191,7 +297,8 @@ void PackCdo(const std::string& base_cdo_path, std::string obj_path,
     std::reverse(obj.faces.begin(), obj.faces.end());
 
     // Convert to CDO LOD.
-    Model& m = cdo.lods[i];
+    Model& m = lod.model;
+    m = cdo.lods[i];
 
     // TODO(commongear): we don't know what these fields are in the model, but
     // leaving them nonzero sometimes prevents loading the model into a race.
@@ -201,16 +308,37 @@ void PackCdo(const std::string& base_cdo_path, std::string obj_path,
     m.header.unknown4 = 0;
     m.header.unknown5 = 0;
 
-    UpdateFromObj(obj, m);
-    std::cout << "Converted to CDO LOD " << i << "\n" << m.header << std::endl;
+    {
+      TraceScope trace("UpdateFromObj");
+      UpdateFromObj(obj, m);
+    }
+    lod.log << "Converted to CDO LOD " << i << "\n" << m.header << std::endl;
 
     // The 0-th LOD has 12 palettes; the other LODs have 1.
     const int max_palettes = (i == 0 ? 12 : 1);
 
     // Extract and quantize the palette from the texture.
-    TexturePaletteData texpal = ExtractFacePalettes(texture, m);
-    MergePalettes(texpal.palettes, max_palettes, /*max_colors=*/16);
-    CHECK_LE(texpal.palettes.size(), max_palettes);
+    TraceScope palettes("PackCdo palettes");
+    ExtractFacePalettes(texture, m, *lod.texpal);
+    MergePalettes(lod.texpal->palettes, max_palettes, /*max_colors=*/16,
+                  quantizer);
+    CHECK_LE(lod.texpal->palettes.size(), max_palettes);
+  });
+
+  // Commit the LODs in order; palette indices depend on the LODs before.
+  int first_palette_index = 3;
+  for (int i = 0; i < lods.size(); ++i) {
+    Lod& lod = lods[i];
+    warn << lod.warnings.str() << std::flush;
+    log << lod.log.str() << std::flush;
+    if (!lod.found) {
+      cdo.lods[i] = Model();
+      continue;
+    }
+    TraceScope trace("PackCdo commit LOD");
+    Model& m = cdo.lods[i];
+    m = std::move(lod.model);
+    const TexturePaletteData& texpal = *lod.texpal;
 
     // Store palette indices back in each LOD.
     AssignPaletteIndicesToFaces(texpal.palettes, first_palette_index, m);
@@ -223,67 +351,220 @@ void PackCdo(const std::string& base_cdo_path, std::string obj_path,
     // Each successive LOD palette starts one index lower.
     --first_palette_index;
   }
-  color_index.GrowBorders(color_mask);
-  PackCarPixData(color_index, cdp);
-  // PackCarPixTo4bpp(cdp);
+  {
+    TraceScope trace("PackCdo pack CDP");
+    Dilation(color_mask, 1).Apply(color_index);
+    PackCarPixData(color_index, cdp);
+    // PackCarPixTo4bpp(cdp);
+  }
 
   {  // Save the CDP file.
+    TraceScope trace("PackCdo save CDP");
     VecOutStream cdp_data;
     cdp.Serialize(cdp_data);
-
-    std::string out_cdp_path = out_path + obj_stem;
-    if (EndsWith(out_cdp_path, ".cdo") || EndsWith(out_cdp_path, ".cno")) {
-      out_cdp_path.resize(out_cdp_path.size() - 4);
-    }
-    out_cdp_path += (is_day ? ".cdp" : ".cnp");
-    Save(cdp_data.GetData(), out_cdp_path);
+    Save(cdp_data.GetData(), paths.out_cdp_path);
   }
 
   {  // Save the CDO file.
+    TraceScope trace("PackCdo save CDO");
     VecOutStream cdo_data;
     cdo.Serialize(cdo_data);
-    std::string out_cdo_path = out_path + obj_stem;
-    if (is_day) {
-      if (!EndsWith(out_cdo_path, ".cdo")) out_cdo_path += ".cdo";
-    } else {
-      if (!EndsWith(out_cdo_path, ".cno")) out_cdo_path += ".cno";
-    }
     const auto cdo_data_str = cdo_data.GetData();
-    Save(cdo_data_str, out_cdo_path);
+    Save(cdo_data_str, paths.out_cdo_path);
     CHECK_LE(cdo_data_str.size(), 20480,
              "Output CDO is too large; may crash when loaded into a race.");
   }
 }
 
+// Reads a base CDO/CNO.
+CarObject LoadBaseCdo(const std::string& path) {
+  TraceScope trace("LoadBaseCdo", path);
+  FileInStream file(path);
+  return CarObject::FromStream(file);
+}
+
+// Converts one OBJ (and its LODs) to CDO/CDP.
+void PackCdo(const std::string& base_cdo_path, const std::string& obj_path,
+             const std::string& out_path, bool is_day, Quantizer quantizer,
+             int num_threads) {
+  const PackPaths paths =
+      FindPackPaths(base_cdo_path, obj_path, out_path, is_day, std::cout);
+  ThreadPool pool(std::min(num_threads, 3));
+  PackCdo(paths, LoadBaseCdo(base_cdo_path), quantizer, pool, std::cout,
+          std::cerr);
+}
+
+// Fingerprint of everything a 'packcdo' conversion reads, so unchanged jobs
+// can be skipped.
+uint32_t PackFingerprint(const PackPaths& paths, Quantizer quantizer) {
+  uint32_t crc = Crc32(StrCat("quantizer ", static_cast<int>(quantizer)));
+  const auto add_file = [&](const std::string& path) {
+    crc = Crc32(path, crc);
+    crc = Crc32(Load(path), crc);
+  };
+  add_file(paths.base_cdo_path);
+  for (const auto& p : paths.obj_paths) add_file(p);
+  add_file(paths.tex_path);
+  return Crc32(paths.out_cdo_path + "\n" + paths.out_cdp_path, crc);
+}
+
+// Runs 'packcdo' for every job in a manifest; see the usage.
+//  - Jobs run in parallel on one pool. Each base CDO is read once.
+//  - Fingerprints of each job's inputs are kept in '<manifest>.state'. Jobs
+//    whose inputs and outputs are as they were last time are skipped, unless
+//    'force' is set.
+void PackBatch(const std::string& manifest_path, Quantizer quantizer,
+               int num_threads, bool force) {
+  const Json manifest = Json::FromString(Load(manifest_path));
+  const Json* jobs_json = (manifest.is_array() ? &manifest : nullptr);
+  if (!jobs_json) jobs_json = manifest.Find("jobs");
+  CHECK(jobs_json && jobs_json->is_array(),
+        "Manifest should be an array of jobs, or have one in 'jobs'.");
+
+  // Relative paths are relative to the manifest. They're made absolute, so
+  // the state (keyed and fingerprinted by path) holds wherever we run from.
+  const std::filesystem::path root =
+      std::filesystem::absolute(manifest_path).parent_path();
+  const auto resolve = [&](const std::string& p) {
+    return (root / p).lexically_normal().generic_string();
+  };
+
+  struct Job {
+    PackPaths paths;
+    std::stringstream log;
+    uint32_t fingerprint = 0;
+    bool up_to_date = false;
+  };
+  std::vector<Job> jobs(jobs_json->array.size());
+  for (int i = 0; i < jobs.size(); ++i) {
+    const Json& j = jobs_json->array[i];
+    CHECK(j.is_object(), "Manifest job ", i, " should be an object.");
+    const std::string base = j.GetString("base");
+    const std::string obj = j.GetString("obj");
+    const std::string out = j.GetString("out");
+    CHECK(!base.empty() && !obj.empty() && !out.empty(),
+          "Manifest job ", i, " needs 'base', 'obj' and 'out'.");
+    // Like 'packcdo', 'out' is a folder.
+    jobs[i].paths = FindPackPaths(resolve(base), resolve(obj),
+                                  resolve(out) + "/", !j.GetBool("night"),
+                                  jobs[i].log);
+  }
+
+  // What we did last time.
+  const std::string state_path = manifest_path + ".state";
+  Json state;
+  if (!force && std::filesystem::exists(state_path)) {
+    state = Json::FromString(Load(state_path));
+  }
+
+  ThreadPool pool(num_threads);
+  ParallelFor(pool, jobs.size(), [&](int i) {
+    Job& job = jobs[i];
+    job.fingerprint = PackFingerprint(job.paths, quantizer);
+    job.up_to_date =
+        (state.GetString(job.paths.out_cdo_path) == StrCat(job.fingerprint) &&
+         std::filesystem::exists(job.paths.out_cdo_path) &&
+         std::filesystem::exists(job.paths.out_cdp_path));
+  });
+
+  // Cars often share a base; read each one once.
+  std::map<std::string, CarObject> bases;
+  for (const Job& job : jobs) {
+    const std::string& p = job.paths.base_cdo_path;
+    if (!job.up_to_date && !bases.count(p)) bases.emplace(p, LoadBaseCdo(p));
+  }
+
+  std::mutex mutex;  // Guards the console and the state file.
+  int num_done = 0;
+  const auto save_state = [&] {
+    std::string out = "{\n";
+    bool first = true;
+    for (const Job& job : jobs) {
+      if (!job.up_to_date) continue;
+      out += StrCat(first ? "" : ",\n", "  ", JsonQuote(job.paths.out_cdo_path),
+                    ": ", JsonQuote(StrCat(job.fingerprint)));
+      first = false;
+    }
+    Save(out + "\n}\n", state_path);
+  };
+  ParallelFor(pool, jobs.size(), [&](int i) {
+    Job& job = jobs[i];
+    if (job.up_to_date) return;
+    // LODs convert serially here; the pool is busy with other cars.
+    ThreadPool serial(1);
+    PackCdo(job.paths, bases.at(job.paths.base_cdo_path), quantizer, serial,
+            job.log, job.log);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << job.log.str() << std::flush;
+    job.up_to_date = true;
+    ++num_done;
+    save_state();
+  });
+  std::lock_guard<std::mutex> lock(mutex);
+  save_state();
+  std::cout << "Packed " << num_done << " cars; " << jobs.size() - num_done
+            << " were up to date." << std::endl;
+}
+
 int main(int argc, char** argv) {
-  if (argc < 2) {
+  Args args(argc, argv);
+  ExportOptions options;
+  options.indexed_png = args.PopSwitch("--indexed-png");
+  options.profile =
+      ExportProfileFromString(args.PopString("--profile", "debug"));
+  options.padding = args.PopInt("--padding", 1);
+  CHECK_GE(options.padding, 0, "--padding can't be negative.");
+  const int num_threads = args.PopInt("-j", 3);
+  CHECK_GT(num_threads, 0, "-j needs at least one thread.");
+  const Quantizer quantizer =
+      QuantizerFromString(args.PopString("--quantizer", "farthest"));
+  const bool force = args.PopSwitch("--force");
+  const TraceSession trace("cdotool", args.PopSwitch("--stats"),
+                           args.PopString("--trace"));
+
+  if (args.size() < 2) {
     std::cerr << "Need a command to execute.\n" << std::endl;
     PrintUsage();
     return -1;
   }
 
-  const std::string command(argv[1]);
+  const std::string command(args[1]);
   if (command == "getobjs") {
-    if (argc != 4) {
+    if (args.size() != 4) {
       std::cerr << "Need a CDO and an output path.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    GetObjs(argv[2], argv[3], /*make_wheels=*/true);
+    GetObjs(args[2], args[3], /*make_wheels=*/true, CarFormat::kObj, options);
   } else if (command == "getobjs-nowheels") {
-    if (argc != 4) {
+    if (args.size() != 4) {
       std::cerr << "Need a CDO and an output path.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    GetObjs(argv[2], argv[3], /*make_wheels=*/false);
+    GetObjs(args[2], args[3], /*make_wheels=*/false, CarFormat::kObj, options);
+  } else if (command == "getglb") {
+    if (args.size() != 4) {
+      std::cerr << "Need a CDO and an output path.\n" << std::endl;
+      PrintUsage();
+      return -1;
+    }
+    GetObjs(args[2], args[3], /*make_wheels=*/true, CarFormat::kGlb, options);
   } else if (command == "packcdo") {
-    if (argc != 5) {
+    if (args.size() != 5) {
       std::cerr << "Need base CDO, OBJ, and an output path.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    PackCdo(argv[2], argv[3], argv[4], /*is_day=*/true);
+    PackCdo(args[2], args[3], args[4], /*is_day=*/true, quantizer,
+            num_threads);
+  } else if (command == "packbatch") {
+    if (args.size() != 3) {
+      std::cerr << "Need a manifest.\n" << std::endl;
+      PrintUsage();
+      return -1;
+    }
+    PackBatch(args[2], quantizer, num_threads, force);
   } else {
     std::cerr << "Unknown command: " << command << std::endl;
     PrintUsage();
@@ -0,0 +1,84 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_ARGS_H_
+#define GT2_EXTRACT_ARGS_H_
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "inspect.h"
+
+namespace gt2 {
+
+// Command line arguments, with optional flags picked out of them.
+//  - Flags may appear anywhere: "-j 8", "--trace out.json". Short integer
+//    flags may have the value attached: "-j8".
+//  - Whatever isn't a flag is left in 'positional', in order, after the
+//    program (which is never taken for a flag).
+class Args {
+ public:
+  Args(int argc, char** argv) : positional(argv, argv + argc) {}
+
+  // Removes flag 'name' and its value. Returns the value, or 'fallback'.
+  std::string PopString(std::string_view name, std::string fallback = "") {
+    for (int i = 1; i < positional.size(); ++i) {
+      if (positional[i] != name) continue;
+      CHECK_LT(i + 1, positional.size(), "Flag needs a value: ", name);
+      std::string out = positional[i + 1];
+      positional.erase(positional.begin() + i, positional.begin() + i + 2);
+      return out;
+    }
+    return fallback;
+  }
+
+  // Removes flag 'name' and parses its value as an integer.
+  //  - A short flag's value may be attached as digits, e.g. "-j8". Anything
+  //    else that starts with the flag (e.g. a pattern "-j.*") is positional.
+  int64_t PopInt(std::string_view name, int64_t fallback) {
+    std::string value = PopString(name);
+    for (int i = 1; value.empty() && i < positional.size(); ++i) {
+      const std::string& a = positional[i];
+      if (name.size() == 2 && a.size() > 2 && StartsWith(a, name) &&
+          IsDigits(std::string_view(a).substr(2))) {
+        value = a.substr(2);
+        positional.erase(positional.begin() + i);
+      }
+    }
+    if (value.empty()) return fallback;
+    char* end = nullptr;
+    const int64_t out = std::strtoll(value.c_str(), &end, 10);
+    CHECK(end && *end == '\0', "Flag ", name, " needs a number: ", value);
+    return out;
+  }
+
+  // Removes switch 'name'. Returns true if it was present.
+  bool PopSwitch(std::string_view name) {
+    for (int i = 1; i < positional.size(); ++i) {
+      if (positional[i] == name) {
+        positional.erase(positional.begin() + i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int size() const { return positional.size(); }
+  const std::string& operator[](int i) const { return positional[i]; }
+
+  std::vector<std::string> positional;
+
+ private:
+  static bool IsDigits(std::string_view s) {
+    for (const char c : s) {
+      if (c < '0' || c > '9') return false;
+    }
+    return !s.empty();
+  }
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_ARGS_H_
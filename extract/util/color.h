@@ -4,8 +4,9 @@
 #ifndef GT2_COLOR_H_
 #define GT2_COLOR_H_
 
+#include <algorithm>
 #include <limits>
-#include <map>
+#include <string_view>
 #include <vector>
 
 #include "../car.h"  // For Color16.
@@ -23,6 +24,96 @@ inline int64_t ColorDistSq(Color16 a, Color16 b) {
   return dr * dr + dg * dg + db * db + da * da;
 }
 
+// Number of pixels of each color, sorted by color.
+//  - A flat vector: palettes hold a handful of colors, so scans beat trees.
+//  - Counts are 32-bit, so large faces don't overflow.
+class ColorHistogram {
+ public:
+  struct Entry {
+    Color16 color;
+    uint32_t count = 0;
+  };
+
+  int size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  void clear() { entries_.clear(); }
+  const Entry& operator[](int i) const { return entries_[i]; }
+  std::vector<Entry>::const_iterator begin() const { return entries_.begin(); }
+  std::vector<Entry>::const_iterator end() const { return entries_.end(); }
+
+  // Adds 'count' pixels of 'color'. Cheapest when colors come in order.
+  void Add(Color16 color, uint32_t count) {
+    if (entries_.empty() || entries_.back().color < color) {
+      entries_.push_back({color, count});
+      return;
+    }
+    const auto it = LowerBound(color);
+    if (it != entries_.end() && it->color == color) {
+      it->count += count;
+    } else {
+      entries_.insert(it, {color, count});
+    }
+  }
+
+  // Adds all the colors and counts from 'b', in one pass over both.
+  void Merge(const ColorHistogram& b) {
+    std::vector<Entry> out;
+    out.reserve(entries_.size() + b.entries_.size());
+    auto i = entries_.begin();
+    auto j = b.entries_.begin();
+    const auto i_end = entries_.end();
+    const auto j_end = b.entries_.end();
+    while (i != i_end || j != j_end) {
+      if (j == j_end || (i != i_end && i->color < j->color)) {
+        out.push_back(*i++);
+      } else if (i == i_end || j->color < i->color) {
+        out.push_back(*j++);
+      } else {
+        out.push_back({i->color, i->count + j->count});
+        ++i;
+        ++j;
+      }
+    }
+    entries_.swap(out);
+  }
+
+ private:
+  std::vector<Entry>::iterator LowerBound(Color16 color) {
+    return std::lower_bound(
+        entries_.begin(), entries_.end(), color,
+        [](const Entry& e, Color16 c) { return e.color < c; });
+  }
+
+  std::vector<Entry> entries_;
+};
+
+// Counts pixels per color in a flat table indexed by the 16-bit color, then
+// hands them out as a 'ColorHistogram'. Keep one around; it's 256KB.
+class ColorCounter {
+ public:
+  ColorCounter() : counts_(1 << 16) {}
+
+  void Add(Color16 color) {
+    if (counts_[color.data]++ == 0) seen_.push_back(color);
+  }
+
+  // Returns the counts so far, and starts over.
+  ColorHistogram Take() {
+    std::sort(seen_.begin(), seen_.end());
+    ColorHistogram out;
+    for (const Color16 c : seen_) {
+      out.Add(c, counts_[c.data]);
+      counts_[c.data] = 0;
+    }
+    seen_.clear();
+    return out;
+  }
+
+ private:
+  std::vector<uint32_t> counts_;
+  std::vector<Color16> seen_;
+};
+
 // Distance between two palettes.
 struct PaletteDist {
   // Sum of square color distances between each best matching color pair.
@@ -31,43 +122,182 @@ struct PaletteDist {
   // Number of colors in the union of the two palettes.
   int64_t union_size = 0;
 };
-inline PaletteDist ComputePaletteDist(const std::map<Color16, uint16_t>& a,
-                                      const std::map<Color16, uint16_t>& b) {
-  std::vector<Color16> va;
-  va.reserve(a.size());
-  for (const auto& kv : a) va.push_back(kv.first);
-
-  std::vector<Color16> vb;
-  vb.reserve(b.size());
-  for (const auto& kv : b) vb.push_back(kv.first);
-
-  // Make sure 'a' is always smaller than 'b'.
-  if (va.size() > vb.size()) std::swap(va, vb);
-  const int a_size = va.size();
-  const int b_size = vb.size();
+inline PaletteDist ComputePaletteDist(const ColorHistogram& a,
+                                      const ColorHistogram& b) {
+  // Make sure 'small' is never larger than 'large'.
+  const ColorHistogram& small = (a.size() > b.size() ? b : a);
+  const ColorHistogram& large = (a.size() > b.size() ? a : b);
 
   PaletteDist out;
-  out.union_size = vb.size();
+  out.union_size = large.size();
+
+  // Both are sorted, so shared colors fall out of one walk over the two.
+  int j_shared = 0;
+  for (const auto& e : small) {
+    while (j_shared < large.size() && large[j_shared].color < e.color) {
+      ++j_shared;
+    }
+    if (j_shared < large.size() && large[j_shared].color == e.color) continue;
 
-  // For each color in 'a'...
-  for (int i = 0; i < a_size; ++i) {
-    // Find the distance to the nearest color in 'b'...
+    // Otherwise find the distance to the nearest color in 'large'...
     int64_t sq_dist = kInt64Max;
-    for (int j = 0; j < b_size; ++j) {
-      sq_dist = std::min(sq_dist, ColorDistSq(va[i], vb[j]));
+    for (const auto& f : large) {
+      sq_dist = std::min(sq_dist, ColorDistSq(e.color, f.color));
     }
     // Tally the result.
-    if (sq_dist > 0) ++out.union_size;
+    ++out.union_size;
     out.sum_sq_dist += sq_dist;
   }
   return out;
 }
 
-// Expects a map of color -> num_pixels.
+// Algorithms for 'QuantizeColors'.
+enum class Quantizer {
+  // Greedy farthest-point selection. The original; slow on many colors.
+  kFarthest,
+  // Weighted median cut in 5-bit RGB. Near-linear, and keeps more of the
+  // colors that cover the most pixels.
+  kMedianCut,
+};
+
+// Parses "farthest" or "median-cut".
+inline Quantizer QuantizerFromString(std::string_view s) {
+  if (s == "farthest") return Quantizer::kFarthest;
+  if (s == "median-cut") return Quantizer::kMedianCut;
+  FAIL("Unknown quantizer '", s, "'. Try farthest or median-cut.");
+  return Quantizer::kFarthest;
+}
+
+// Median cut version of 'QuantizeColors'; see below.
+//  - Repeatedly splits the box of colors with the largest pixel-weighted
+//    spread at the weighted median of its widest channel.
+//  - Each box becomes the color in it nearest to its weighted mean, so the
+//    result is always a subset of the input colors.
+inline void QuantizeColorsMedianCut(ColorHistogram& inout_colors, int n) {
+  CHECK_GT(n, 0);
+  if (inout_colors.size() <= n) return;
+
+  // Transparent pixels keep a color of their own.
+  uint32_t transparent = 0;
+  std::vector<ColorHistogram::Entry> colors;
+  colors.reserve(inout_colors.size());
+  for (const auto& e : inout_colors) {
+    if (e.color.data == 0) {
+      transparent += e.count;
+    } else {
+      colors.push_back(e);
+    }
+  }
+  const int to_find = std::max(1, transparent ? n - 1 : n);
+
+  const auto channel = [](Color16 c, int axis) {
+    return axis == 0 ? c.r5() : (axis == 1 ? c.g5() : c.b5());
+  };
+
+  // Colors [begin, end), and the channel with the largest weighted spread.
+  struct Box {
+    int begin;
+    int end;
+    int axis;
+    double spread;
+  };
+  const auto make_box = [&](int begin, int end) {
+    double sum[3] = {}, sum_sq[3] = {}, weight = 0;
+    for (int i = begin; i < end; ++i) {
+      const double w = colors[i].count;
+      for (int k = 0; k < 3; ++k) {
+        const double v = channel(colors[i].color, k);
+        sum[k] += w * v;
+        sum_sq[k] += w * v * v;
+      }
+      weight += w;
+    }
+    Box box = {begin, end, 0, -1};
+    for (int k = 0; k < 3; ++k) {
+      const double spread =
+          (weight > 0 ? sum_sq[k] - sum[k] * sum[k] / weight : 0);
+      if (spread > box.spread) {
+        box.spread = spread;
+        box.axis = k;
+      }
+    }
+    return box;
+  };
+
+  std::vector<Box> boxes = {make_box(0, colors.size())};
+  while (boxes.size() < to_find) {
+    // Split the widest box that still has more than one color.
+    int i_split = -1;
+    for (int i = 0; i < boxes.size(); ++i) {
+      if (boxes[i].end - boxes[i].begin < 2) continue;
+      if (i_split < 0 || boxes[i].spread > boxes[i_split].spread) i_split = i;
+    }
+    if (i_split < 0) break;
+    const Box box = boxes[i_split];
+
+    const auto first = colors.begin() + box.begin;
+    const auto last = colors.begin() + box.end;
+    std::sort(first, last, [&](const auto& a, const auto& b) {
+      const int ca = channel(a.color, box.axis);
+      const int cb = channel(b.color, box.axis);
+      return ca != cb ? ca < cb : a.color < b.color;
+    });
+
+    // Weighted median, keeping at least one color on each side.
+    uint64_t total = 0;
+    for (auto it = first; it != last; ++it) total += it->count;
+    uint64_t below = 0;
+    int mid = box.begin + 1;
+    for (int i = box.begin; i < box.end - 1; ++i) {
+      below += colors[i].count;
+      mid = i + 1;
+      if (2 * below >= total) break;
+    }
+
+    boxes[i_split] = make_box(box.begin, mid);
+    boxes.push_back(make_box(mid, box.end));
+  }
+
+  // Pick a color for each box; it gets all of the box's pixels.
+  inout_colors.clear();
+  for (const Box& box : boxes) {
+    double mean[3] = {}, weight = 0;
+    uint32_t num_pixels = 0;
+    for (int i = box.begin; i < box.end; ++i) {
+      const double w = colors[i].count;
+      for (int k = 0; k < 3; ++k) mean[k] += w * channel(colors[i].color, k);
+      weight += w;
+      num_pixels += colors[i].count;
+    }
+    int i_best = box.begin;
+    double d_best = std::numeric_limits<double>::infinity();
+    for (int i = box.begin; i < box.end; ++i) {
+      double d = 0;
+      for (int k = 0; k < 3; ++k) {
+        const double v = channel(colors[i].color, k) * weight - mean[k];
+        d += v * v;
+      }
+      if (d < d_best) {
+        d_best = d;
+        i_best = i;
+      }
+    }
+    inout_colors.Add(colors[i_best].color, num_pixels);
+  }
+  if (transparent) inout_colors.Add(Color16(), transparent);
+}
+
+// Expects a histogram of color -> num_pixels.
 //   color: an entry in the output palette.
 //   num_pixels: number of pixels in the original texture which are this color.
 //   n: the maximum number of colors to retain.
-inline void QuantizeColors(std::map<Color16, uint16_t>& inout_colors, int n) {
+//   quantizer: how to choose them.
+inline void QuantizeColors(ColorHistogram& inout_colors, int n,
+                           Quantizer quantizer = Quantizer::kFarthest) {
+  if (quantizer == Quantizer::kMedianCut) {
+    QuantizeColorsMedianCut(inout_colors, n);
+    return;
+  }
   constexpr float kInf = std::numeric_limits<float>::infinity();
 
   CHECK_GT(n, 0);
@@ -75,7 +305,7 @@ inline void QuantizeColors(std::map<Color16, uint16_t>& inout_colors, int n) {
 
   struct Color {
     Color16 color;
-    uint16_t num_pixels;
+    uint32_t num_pixels;
     float score;
   };
 
@@ -85,12 +315,11 @@ inline void QuantizeColors(std::map<Color16, uint16_t>& inout_colors, int n) {
   // Transfer colors to a vector, treating transparent ones separately.
   std::vector<Color> colors;
   colors.reserve(inout_colors.size());
-  for (const auto& kv : inout_colors) {
-    if (kv.first.data == 0) {
-      transparent.num_pixels += kv.second;
+  for (const auto& e : inout_colors) {
+    if (e.color.data == 0) {
+      transparent.num_pixels += e.count;
     } else {
-      colors.push_back(
-          {.color = kv.first, .num_pixels = kv.second, .score = kInf});
+      colors.push_back({.color = e.color, .num_pixels = e.count, .score = kInf});
     }
   }
 
@@ -102,9 +331,9 @@ inline void QuantizeColors(std::map<Color16, uint16_t>& inout_colors, int n) {
 
     // Find the color with the most pixels.
     int c_next = 0;
-    int c_num = colors[c_next].num_pixels;
+    uint32_t c_num = colors[c_next].num_pixels;
     for (int i = 1; i < colors.size(); ++i) {
-      const int num_pixels = colors[i].num_pixels;
+      const uint32_t num_pixels = colors[i].num_pixels;
       if (num_pixels < c_num) {
         c_num = num_pixels;
         c_next = i;
@@ -157,7 +386,7 @@ inline void QuantizeColors(std::map<Color16, uint16_t>& inout_colors, int n) {
 
   // Output resulting colors.
   inout_colors.clear();
-  for (const auto& e : final) inout_colors[e.color] = e.num_pixels;
+  for (const auto& e : final) inout_colors.Add(e.color, e.num_pixels);
 }
 
 }  // namespace gt2
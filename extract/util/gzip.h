@@ -6,6 +6,7 @@
 
 #include <cstring>
 #include <iostream>
+#include <type_traits>
 
 #include "io.h"
 
@@ -48,61 +49,114 @@ constexpr uint8_t GZIP_OS_UNKNOWN = 255;
 // GZIP: https://tools.ietf.org/html/rfc1952#page-11
 // ZLIB: https://tools.ietf.org/html/rfc1950
 
-// Inflates from a stream until the data end is reached.
-template <typename Stream>
-std::string Inflate(Stream& s) {
-  constexpr int64_t kBufSize = 64 * 1024;
-
-  const int64_t initial_pos = s.pos();
-  int64_t remaining = s.remain();
-
-  std::string in(kBufSize, '\0');
-  std::string out(kBufSize, '\0');
-
-  miniz::mz_stream mz;
-  std::memset(&mz, 0, sizeof(mz));
-  mz.next_in = reinterpret_cast<unsigned char*>(in.data());
-  mz.avail_in = 0;
-  mz.next_out = reinterpret_cast<unsigned char*>(out.data());
-  mz.avail_out = kBufSize;
-
-  // No zlib headers (we read them already).
-  CHECK_EQ(mz_inflateInit2(&mz, -15), miniz::MZ_OK);
-  while (true) {
-    if (mz.avail_in == 0) {
-      const int64_t to_read = std::min(kBufSize, remaining);
-      s.ReadInto(in.data(), to_read);
-      in.resize(to_read);
-      remaining -= in.size();
-      mz.next_in = reinterpret_cast<unsigned char*>(in.data());
-      mz.avail_in = in.size();
+// Inflated data is produced in chunks of this size.
+constexpr int64_t kInflateChunkSize = 64 * 1024;
+
+// Inflates raw deflate data.
+//  - Keeps its decompressor state and buffers between calls, so one per thread
+//    can inflate thousands of small files without any setup or allocation.
+//  - Not thread-safe; use one per thread.
+class Inflater {
+ public:
+  Inflater() : in_(kInflateChunkSize, '\0'), out_(kInflateChunkSize, '\0') {
+    std::memset(&mz_, 0, sizeof(mz_));
+    // No zlib headers (we read them already).
+    CHECK_EQ(mz_inflateInit2(&mz_, -15), miniz::MZ_OK);
+  }
+  ~Inflater() { miniz::mz_inflateEnd(&mz_); }
+
+  Inflater(const Inflater&) = delete;
+  Inflater& operator=(const Inflater&) = delete;
+
+  // Inflates from a stream until the data end is reached.
+  //  - Output is passed to 'sink(std::string_view)' one chunk at a time, so
+  //    the whole output never has to be in memory at once.
+  //  - Returns the total number of bytes inflated.
+  template <typename Stream, typename Sink>
+  int64_t Inflate(Stream& s, Sink&& sink) {
+    constexpr int64_t kBufSize = kInflateChunkSize;
+
+    const int64_t initial_pos = s.pos();
+    int64_t remaining = s.remain();
+
+    CHECK_EQ(miniz::mz_inflateReset(&mz_), miniz::MZ_OK);
+    mz_.next_in = reinterpret_cast<unsigned char*>(in_.data());
+    mz_.avail_in = 0;
+    mz_.next_out = reinterpret_cast<unsigned char*>(out_.data());
+    mz_.avail_out = kBufSize;
+
+    // In-memory streams can be inflated in place, without the input buffer.
+    if constexpr (std::is_base_of_v<ViewInStream, Stream>) {
+      const std::string_view rest = s.rest();
+      mz_.next_in = reinterpret_cast<const unsigned char*>(rest.data());
+      mz_.avail_in = rest.size();
+      remaining = 0;
     }
-    const int status = mz_inflate(&mz, miniz::MZ_SYNC_FLUSH);
-    if (status == miniz::MZ_STREAM_END) {
-      break;
-    } else if (mz.avail_out == 0) {
-      int64_t old_size = out.size();
-      out.resize(2 * old_size);
-      mz.next_out = reinterpret_cast<unsigned char*>(out.data() + old_size);
-      mz.avail_out = old_size;
-    } else if (status != miniz::MZ_OK) {
-      std::cerr << status << std::endl;
+
+    while (true) {
+      if (mz_.avail_in == 0) {
+        const int64_t to_read = std::min(kBufSize, remaining);
+        s.ReadInto(in_.data(), to_read);
+        remaining -= to_read;
+        mz_.next_in = reinterpret_cast<unsigned char*>(in_.data());
+        mz_.avail_in = to_read;
+      }
+      const int status = mz_inflate(&mz_, miniz::MZ_SYNC_FLUSH);
+      // Hand off each full chunk, and whatever is left at the end.
+      if (status == miniz::MZ_STREAM_END || mz_.avail_out == 0) {
+        const int64_t size = kBufSize - mz_.avail_out;
+        if (size > 0) sink(std::string_view(out_.data(), size));
+        mz_.next_out = reinterpret_cast<unsigned char*>(out_.data());
+        mz_.avail_out = kBufSize;
+      }
+      if (status == miniz::MZ_STREAM_END) {
+        break;
+      } else if (status != miniz::MZ_OK) {
+        std::cerr << status << std::endl;
+      }
+      CHECK_EQ(status, miniz::MZ_OK);
     }
-    CHECK_EQ(status, miniz::MZ_OK);
+
+    // Bookkeeping.
+    s.set_pos(initial_pos + mz_.total_in);
+    return mz_.total_out;
   }
 
-  // Bookkeeping.
-  s.set_pos(initial_pos + mz.total_in);
-  out.resize(mz.total_out);
-  CHECK_EQ(miniz::mz_inflateEnd(&mz), miniz::MZ_OK);
+ private:
+  miniz::mz_stream mz_;
+  std::string in_;
+  std::string out_;
+};
 
+// Inflates from a stream until the data end is reached.
+//  - Output is passed to 'sink(std::string_view)' one chunk at a time.
+//  - Pass an 'inflater' to reuse its state; otherwise a new one is made.
+//  - Returns the total number of bytes inflated.
+template <typename Stream, typename Sink>
+int64_t InflateTo(Stream& s, Sink&& sink, Inflater* inflater = nullptr) {
+  if (inflater) return inflater->Inflate(s, sink);
+  Inflater local;
+  return local.Inflate(s, sink);
+}
+
+// Inflates from a stream until the data end is reached.
+//  - If the output size is known, pass it as 'size_hint' so the output is
+//    allocated once, instead of growing as it goes.
+template <typename Stream>
+std::string Inflate(Stream& s, int64_t size_hint = 0,
+                    Inflater* inflater = nullptr) {
+  std::string out;
+  out.reserve(size_hint);
+  InflateTo(
+      s, [&out](std::string_view chunk) { out.append(chunk); }, inflater);
   return out;
 }
 
 // Computes the CRC32 of some data.
-uint32_t Crc32(const std::string& data) {
-  return miniz::mz_crc32(0, reinterpret_cast<const unsigned char*>(data.data()),
-                         data.size());
+//  - Pass the result back in as 'crc' to continue with more data.
+uint32_t Crc32(std::string_view data, uint32_t crc = 0) {
+  return miniz::mz_crc32(
+      crc, reinterpret_cast<const unsigned char*>(data.data()), data.size());
 }
 
 // One member of a GZip file (there may be multiple).
@@ -162,11 +216,19 @@ struct GzipMember {
   std::string name;
   std::string comment;
   uint16_t header_crc = 0;
-  std::string inflated;
+  std::string inflated;  // Empty if the data was streamed to a sink.
+  int64_t inflated_size = 0;
   Footer footer;
 
-  template <typename Stream>
-  static GzipMember FromStream(Stream& s) {
+  // Reads a member, passing the inflated data to 'sink(std::string_view)' in
+  // chunks instead of storing it. Memory use is constant, whatever the size.
+  //  - Pass an 'inflater' to reuse it across members (e.g. one per thread).
+  template <typename Stream, typename Sink,
+            typename = std::enable_if_t<
+                std::is_invocable_v<Sink&, std::string_view>>>
+  static GzipMember FromStream(Stream& s, Sink&& sink,
+                               Inflater* inflater = nullptr) {
+    TraceScope trace("GzipMember::FromStream");
     GzipMember out;
     out.header = s.template Read<Header>();
     if (out.header.flags & GZIP_FLAG_EXTRA) out.extra = Extra::FromStream(s);
@@ -175,13 +237,84 @@ struct GzipMember {
     if (out.header.flags & GZIP_FLAG_HCRC) {
       out.header_crc = s.template Read<uint16_t>();
     }
-    out.inflated = Inflate(s);
+    uint32_t crc = 0;
+    out.inflated_size = InflateTo(
+        s,
+        [&](std::string_view chunk) {
+          crc = Crc32(chunk, crc);
+          sink(chunk);
+        },
+        inflater);
     out.footer = s.template Read<Footer>();
-    CHECK_EQ(out.footer.crc, Crc32(out.inflated));
+    // Copies, since the footer fields are packed.
+    const uint32_t footer_crc = out.footer.crc;
+    const uint32_t footer_size = out.footer.uncompressed_size;
+    CHECK_EQ(footer_crc, crc);
+    // The size is stored modulo 2^32.
+    CHECK_EQ(footer_size, static_cast<uint32_t>(out.inflated_size));
+    TraceCount(TraceCounter::kBytesInflated, out.inflated_size);
     return out;
   }
+
+  // Reads a member and stores the inflated data in 'inflated'.
+  //  - Pass an 'inflater' to reuse it across members (e.g. one per thread).
+  template <typename Stream>
+  static GzipMember FromStream(Stream& s, Inflater* inflater = nullptr) {
+    std::string inflated;
+    inflated.reserve(SizeHint(s));
+    GzipMember out = FromStream(
+        s, [&inflated](std::string_view chunk) { inflated.append(chunk); },
+        inflater);
+    out.inflated = std::move(inflated);
+    return out;
+  }
+
+  // Peeks at the footer, assuming the member runs to the end of the stream
+  // (true for files in a VOL). Returns the inflated size, or 0 if unknown.
+  template <typename Stream>
+  static int64_t SizeHint(Stream& s) {
+    const int64_t remain = s.remain();
+    if (remain < static_cast<int64_t>(sizeof(Header) + sizeof(Footer))) {
+      return 0;
+    }
+    const int64_t pos = s.pos();
+    s.set_pos(s.size() - sizeof(Footer));
+    const Footer footer = s.template Read<Footer>();
+    s.set_pos(pos);
+    // If the guess is wrong, don't let it allocate more than deflate's
+    // maximum compression ratio (about 1032:1) could produce.
+    return std::min<int64_t>(footer.uncompressed_size, 1032 * remain);
+  }
 };
 
+// Compresses 'data' into one GZip member, like the ones in a VOL.
+//  - 'level' is the deflate effort, 0 to 10 (6 is gzip's default).
+inline std::string GzipCompress(std::string_view data, int level = 6) {
+  GzipMember::Header header;
+  header.magic[0] = 0x1f;
+  header.magic[1] = 0x8b;
+  header.compression = 8;
+  header.os_id = GZIP_OS_UNIX;
+
+  // Negative window bits: raw deflate, without zlib headers.
+  const int flags = miniz::tdefl_create_comp_flags_from_zip_params(
+      level, -15, miniz::MZ_DEFAULT_STRATEGY);
+  size_t size = 0;
+  void* deflated = miniz::tdefl_compress_mem_to_heap(data.data(), data.size(),
+                                                     &size, flags);
+  CHECK(deflated, "Failed to deflate ", data.size(), " bytes.");
+
+  GzipMember::Footer footer;
+  footer.crc = Crc32(data);
+  footer.uncompressed_size = data.size();
+
+  std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.append(static_cast<const char*>(deflated), size);
+  out.append(reinterpret_cast<const char*>(&footer), sizeof(footer));
+  miniz::mz_free(deflated);
+  return out;
+}
+
 std::ostream& operator<<(std::ostream& os, const GzipMember::Header& h) {
   return os << "{" << ToHex<2>(h.magic)
             << "compression:" << ToHex(h.compression)
@@ -218,7 +351,7 @@ std::ostream& operator<<(std::ostream& os, const GzipMember& m) {
     os << "comment: '" << m.comment << "'\n";
   if (m.header.flags & GZIP_FLAG_HCRC)
     os << "header_crc: " << m.header_crc << "\n";
-  return os << "inflated_size: " << m.inflated.size() << "\n" << m.footer;
+  return os << "inflated_size: " << m.inflated_size << "\n" << m.footer;
 }
 
 }  // namespace gt2
@@ -0,0 +1,229 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_HTTP_H_
+#define GT2_EXTRACT_HTTP_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "inspect.h"
+#include "thread_pool.h"
+
+namespace gt2 {
+
+// What to send back for one request.
+struct HttpResponse {
+  int status = 200;
+  std::string content_type = "application/octet-stream";
+  std::shared_ptr<const std::string> body;
+
+  // A plain-text error page.
+  static HttpResponse Error(int status, std::string_view message) {
+    HttpResponse out;
+    out.status = status;
+    out.content_type = "text/plain";
+    out.body = std::make_shared<const std::string>(StrCat(message, "\n"));
+    return out;
+  }
+};
+
+// Answers a GET for 'path': the decoded request path, without the query.
+using HttpHandler = std::function<HttpResponse(std::string_view path)>;
+
+// Guesses a content type from a file name, for the files the viewer loads.
+inline std::string MimeTypeOf(std::string_view path) {
+  const auto ext = [&](std::string_view e) { return EndsWith(path, e); };
+  if (ext(".html")) return "text/html";
+  // Module scripts refuse to load without a JavaScript type.
+  if (ext(".js")) return "text/javascript";
+  if (ext(".css")) return "text/css";
+  if (ext(".json")) return "application/json";
+  if (ext(".png")) return "image/png";
+  if (ext(".glb")) return "model/gltf-binary";
+  if (ext(".obj") || ext(".mtl") || ext(".txt")) return "text/plain";
+  return "application/octet-stream";
+}
+
+// Decodes '%xx' escapes in a request path. Returns false if one is malformed.
+inline bool DecodeUrlPath(std::string_view in, std::string& out) {
+  const auto hex = [](char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  out.clear();
+  for (size_t i = 0; i < in.size(); ++i) {
+    if (in[i] != '%') {
+      out.push_back(in[i]);
+      continue;
+    }
+    if (i + 2 >= in.size()) return false;
+    const int hi = hex(in[i + 1]);
+    const int lo = hex(in[i + 2]);
+    if (hi < 0 || lo < 0) return false;
+    out.push_back(static_cast<char>(16 * hi + lo));
+    i += 2;
+  }
+  return true;
+}
+
+// A small HTTP server for local tools.
+//  - Listens on 127.0.0.1 only, so only this machine can connect.
+//  - GET and HEAD only. One request per connection ("Connection: close").
+//  - Connections are handled as tasks on a ThreadPool.
+class HttpServer {
+ public:
+  explicit HttpServer(int port) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return;
+#else
+    // A client hanging up mid-response shouldn't take the server down.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_ == kNoSocket) return;
+    const int yes = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR,
+               reinterpret_cast<const char*>(&yes), sizeof(yes));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(socket_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(socket_, SOMAXCONN) != 0) {
+      Close(socket_);
+      socket_ = kNoSocket;
+      return;
+    }
+    port_ = port;
+  }
+
+  HttpServer(const HttpServer&) = delete;
+  HttpServer& operator=(const HttpServer&) = delete;
+
+  ~HttpServer() {
+    if (socket_ != kNoSocket) Close(socket_);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+  }
+
+  // True if the server is listening.
+  bool ok() const { return socket_ != kNoSocket; }
+  int port() const { return port_; }
+
+  // Answers requests with 'handler' until the process ends.
+  void Serve(const HttpHandler& handler, ThreadPool& pool) {
+    CHECK(ok(), "HTTP server isn't listening.");
+    while (true) {
+      const Socket client = accept(socket_, nullptr, nullptr);
+      if (client == kNoSocket) continue;
+      pool.Submit([client, &handler] {
+        Handle(client, handler);
+        Close(client);
+      });
+    }
+  }
+
+ private:
+#ifdef _WIN32
+  using Socket = SOCKET;
+  static constexpr Socket kNoSocket = INVALID_SOCKET;
+  static void Close(Socket s) { closesocket(s); }
+#else
+  using Socket = int;
+  static constexpr Socket kNoSocket = -1;
+  static void Close(Socket s) { close(s); }
+#endif
+
+  // Longest request head we'll read. The viewer's are a few hundred bytes.
+  static constexpr int kMaxHead = 16 << 10;
+
+  static bool SendAll(Socket s, std::string_view data) {
+    while (!data.empty()) {
+      const int n = send(s, data.data(), data.size(), 0);
+      if (n <= 0) return false;
+      data.remove_prefix(n);
+    }
+    return true;
+  }
+
+  static void Respond(Socket s, const HttpResponse& r, bool head_only) {
+    const std::string_view reason = (r.status == 200   ? "OK"
+                                     : r.status == 400 ? "Bad Request"
+                                     : r.status == 404 ? "Not Found"
+                                     : r.status == 405 ? "Method Not Allowed"
+                                                       : "Error");
+    const int64_t size = (r.body ? r.body->size() : 0);
+    const std::string head =
+        StrCat("HTTP/1.1 ", r.status, " ", reason,
+               "\r\nContent-Type: ", r.content_type,
+               "\r\nContent-Length: ", size,
+               "\r\nConnection: close\r\n\r\n");
+    if (!SendAll(s, head) || head_only || !r.body) return;
+    SendAll(s, *r.body);
+  }
+
+  // Reads one request from 's' and answers it.
+  static void Handle(Socket s, const HttpHandler& handler) {
+    std::string head;
+    char buf[4096];
+    while (head.find("\r\n\r\n") == std::string::npos) {
+      if (head.size() > kMaxHead) {
+        return Respond(s, HttpResponse::Error(400, "Request too long."), false);
+      }
+      const int n = recv(s, buf, sizeof(buf), 0);
+      if (n <= 0) return;
+      head.append(buf, n);
+    }
+
+    // Request line: "GET /some/path?query HTTP/1.1".
+    const std::string_view line(head.data(), head.find("\r\n"));
+    const size_t a = line.find(' ');
+    const size_t b = line.find(' ', a + 1);
+    if (a == std::string_view::npos || b == std::string_view::npos) {
+      return Respond(s, HttpResponse::Error(400, "Bad request line."), false);
+    }
+    const std::string_view method = line.substr(0, a);
+    std::string_view target = line.substr(a + 1, b - a - 1);
+    target = target.substr(0, target.find('?'));
+    const bool head_only = (method == "HEAD");
+    if (method != "GET" && !head_only) {
+      return Respond(s, HttpResponse::Error(405, "Only GET is supported."),
+                     false);
+    }
+
+    std::string path;
+    if (!DecodeUrlPath(target, path) || !StartsWith(path, "/")) {
+      return Respond(s, HttpResponse::Error(400, "Bad path."), head_only);
+    }
+    Respond(s, handler(path), head_only);
+  }
+
+  Socket socket_ = kNoSocket;
+  int port_ = 0;
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_HTTP_H_
@@ -8,16 +8,31 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "inspect.h"
+#include "trace.h"
 
 namespace gt2 {
 
 // Loads an entire file.
 inline std::string Load(const std::string& path) {
+  TraceScope trace("Load", path);
   std::ifstream s(path, std::ios::in | std::ios::binary);
   CHECK(s.good(), "Failed to open for read '", path, "'");
 
@@ -28,15 +43,31 @@ inline std::string Load(const std::string& path) {
   std::string out(size, '\0');
   s.read(const_cast<char*>(out.data()), out.size());
   CHECK_EQ(s.tellg(), size, "Failed to read all of '", path, "'");
+  TraceCount(TraceCounter::kBytesRead, size);
   return out;
 }
 
-// Saves an entire file.
-inline void Save(const std::string& buffer, const std::string& path) {
+// Creates any missing folders above 'path'.
+inline void CreateParentDirs(const std::string& path) {
   const std::filesystem::path fspath(path);
   if (fspath.has_parent_path()) {
     std::filesystem::create_directories(fspath.parent_path());
   }
+}
+
+// Unlinks 'path' if other names are hard links to it, so that writing to it
+// doesn't change them too.
+inline void BreakHardLink(const std::string& path) {
+  std::error_code error;
+  const auto links = std::filesystem::hard_link_count(path, error);
+  if (!error && links > 1) std::filesystem::remove(path, error);
+}
+
+// Saves an entire file.
+inline void Save(std::string_view buffer, const std::string& path) {
+  TraceScope trace("Save", path);
+  CreateParentDirs(path);
+  BreakHardLink(path);
 
   std::ofstream s(path, std::ios::out | std::ios::binary);
   CHECK(s.good(), "Failed to open for write '", path, "'");
@@ -44,6 +75,7 @@ inline void Save(const std::string& buffer, const std::string& path) {
   s.write(buffer.data(), buffer.size());
   s.flush();
   CHECK(s.good(), "Failed to write '", path, "'");
+  TraceCount(TraceCounter::kBytesWritten, buffer.size());
 }
 
 // NOTE: I implemented these streams because the C++ std library versions copy
@@ -153,6 +185,7 @@ class FileInStream {
     static_assert(std::is_trivially_copyable<T>::value);
     T out;
     s_.read(reinterpret_cast<char*>(&out), sizeof(T));
+    TraceCount(TraceCounter::kBytesRead, sizeof(T));
     return out;
   }
 
@@ -162,6 +195,7 @@ class FileInStream {
     static_assert(std::is_trivially_copyable<T>::value);
     std::vector<T> out(n);
     s_.read(reinterpret_cast<char*>(out.data()), sizeof(T) * n);
+    TraceCount(TraceCounter::kBytesRead, sizeof(T) * n);
     return out;
   }
 
@@ -170,6 +204,7 @@ class FileInStream {
     CHECK_LE(n, remain());
     std::string out(n, '\0');
     s_.read(const_cast<char*>(out.data()), n);
+    TraceCount(TraceCounter::kBytesRead, n);
     return out;
   }
 
@@ -187,6 +222,7 @@ class FileInStream {
   void ReadInto(char* data, int64_t n) {
     CHECK_LE(n, remain());
     s_.read(data, n);
+    TraceCount(TraceCounter::kBytesRead, n);
   }
 
   // Reads 'n' bytes into the given buffer.
@@ -199,6 +235,289 @@ class FileInStream {
   int64_t size_ = 0;
 };
 
+// A read-only array of 'T' over memory owned by someone else; see
+// ViewInStream::ReadArray. The memory must outlive the view.
+//  - Elements are copied out one at a time, so the memory needn't be aligned.
+//  - Indexing is bounds-checked. Iterating can't go out of bounds.
+template <typename T>
+class ArrayView {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value);
+
+  class Iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = T;
+
+    explicit Iterator(const char* p) : p_(p) {}
+
+    T operator*() const {
+      T out;
+      std::memcpy(&out, p_, sizeof(T));
+      return out;
+    }
+    Iterator& operator++() {
+      p_ += sizeof(T);
+      return *this;
+    }
+    Iterator operator++(int) {
+      const Iterator out = *this;
+      p_ += sizeof(T);
+      return out;
+    }
+    bool operator==(const Iterator& other) const { return p_ == other.p_; }
+    bool operator!=(const Iterator& other) const { return p_ != other.p_; }
+
+   private:
+    const char* p_;
+  };
+
+  // Empty.
+  ArrayView() = default;
+  // Views 'size' elements starting at 'data'.
+  ArrayView(const char* data, int64_t size) : data_(data), size_(size) {}
+
+  int64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T operator[](int64_t i) const {
+    CHECK(0 <= i && i < size_, "Index ", i, " out of bounds: ", size_);
+    T out;
+    std::memcpy(&out, data_ + i * sizeof(T), sizeof(T));
+    return out;
+  }
+
+  Iterator begin() const { return Iterator(data_); }
+  Iterator end() const { return Iterator(data_ + size_ * sizeof(T)); }
+
+ private:
+  const char* data_ = nullptr;
+  int64_t size_ = 0;
+};
+
+// An input stream over memory owned by someone else (e.g. a MappedInStream).
+// Nothing is copied until you ask for it; the memory must outlive the stream.
+class ViewInStream {
+ public:
+  // Empty.
+  ViewInStream() = default;
+  // Views the given data.
+  explicit ViewInStream(std::string_view data) : data_(data) {}
+
+  // Everything is good.
+  bool ok() const { return pos_ <= size(); }
+
+  // Total size of the data.
+  int64_t size() const { return data_.size(); }
+  // Remaining bytes available.
+  int64_t remain() const { return size() - pos(); }
+  // Current position.
+  int64_t pos() const { return pos_; }
+  // Sets the current position.
+  void set_pos(int64_t i) { pos_ = i; }
+
+  // All of the data.
+  std::string_view data() const { return data_; }
+  // The data from the current position to the end.
+  std::string_view rest() const { return data_.substr(pos_); }
+
+  // Returns a stream over 'n' bytes starting at 'pos'.
+  ViewInStream View(int64_t pos, int64_t n) const {
+    CHECK_LE(0, pos);
+    CHECK_LE(pos + n, size(), "View out of bounds.");
+    return ViewInStream(data_.substr(pos, n));
+  }
+
+  // Reads one struct or basic data type.
+  template <typename T>
+  T Read() {
+    static_assert(std::is_trivially_copyable<T>::value);
+    CHECK_LE(sizeof(T), remain(), STR(T));
+    T out;
+    std::memcpy(&out, data_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return out;
+  }
+
+  // Reads 'n' structs or basic data types.
+  template <typename T>
+  std::vector<T> Read(int64_t n) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    CHECK_LE(n * sizeof(T), remain(), STR(T));
+    std::vector<T> out(n);
+    std::memcpy(out.data(), data_.data() + pos_, n * sizeof(T));
+    pos_ += n * sizeof(T);
+    return out;
+  }
+
+  // Returns a view of the next 'n' structs or basic data types, without
+  // copying.
+  template <typename T>
+  ArrayView<T> ReadArray(int64_t n) {
+    CHECK_LE(n * sizeof(T), remain(), STR(T));
+    const ArrayView<T> out(data_.data() + pos_, n);
+    pos_ += n * sizeof(T);
+    return out;
+  }
+
+  // Returns a view of the next 'n' bytes, without copying.
+  std::string_view ReadView(int64_t n) {
+    CHECK_LE(n, remain());
+    const std::string_view out = data_.substr(pos_, n);
+    pos_ += n;
+    return out;
+  }
+
+  // Reads 'n' bytes.
+  std::string ReadData(int64_t n) { return std::string(ReadView(n)); }
+
+  // Reads a null-terminated string.
+  std::string ReadCString() {
+    const int64_t rest = remain();
+    const int64_t size = strnlen(data_.data() + pos_, rest);
+    std::string out = ReadData(size);
+    if (size < rest) ++pos_;  // Skip the terminator.
+    return out;
+  }
+
+  // Reads 'n' bytes into the given buffer.
+  void ReadInto(char* data, int64_t n) {
+    CHECK_LE(n, remain());
+    std::memcpy(data, data_.data() + pos_, n);
+    pos_ += n;
+  }
+
+  // Reads 'n' bytes into the given buffer.
+  void ReadInto(std::string& s) { return ReadInto(s.data(), s.size()); }
+
+ private:
+  std::string_view data_;
+  int64_t pos_ = 0;
+};
+
+// An input stream over a read-only memory-mapped file.
+//  - The whole file is mapped once; reads are memcpys, not syscalls.
+//  - View() hands out bounded sub-streams without copying any data.
+class MappedInStream : public ViewInStream {
+ public:
+  // Empty.
+  MappedInStream() = default;
+  // Maps a path. Check ok() to see if it worked.
+  explicit MappedInStream(const std::string& path) {
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size)) return;
+    size_ = size.QuadPart;
+    if (size_ > 0) {
+      mapping_ =
+          CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (!mapping_) return;
+      data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+      if (!data_) return;
+    }
+#else
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) return;
+    struct stat st;
+    if (fstat(fd_, &st) != 0) return;
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data == MAP_FAILED) return;
+      data_ = data;
+    }
+#endif
+    mapped_ = true;
+    static_cast<ViewInStream&>(*this) = ViewInStream(
+        std::string_view(static_cast<const char*>(data_), size_));
+  }
+
+  // The mapping is unique.
+  MappedInStream(const MappedInStream&) = delete;
+  MappedInStream& operator=(const MappedInStream&) = delete;
+
+  ~MappedInStream() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+    if (data_) munmap(data_, size_);
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+
+  // Everything is good.
+  bool ok() const { return mapped_ && ViewInStream::ok(); }
+
+  // Hints that bytes [pos, pos + n) will be read soon, so the OS can start
+  // reading them in the background. Does nothing if the hint isn't supported.
+  void Prefetch(int64_t pos, int64_t n) const {
+    if (!data_ || n <= 0) return;
+    CHECK_LE(pos + n, size_);
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602  // Windows 8.
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = static_cast<char*>(data_) + pos;
+    range.NumberOfBytes = n;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    // The address must be page-aligned.
+    static const int64_t page = sysconf(_SC_PAGESIZE);
+    const int64_t begin = pos - pos % page;
+    madvise(static_cast<char*>(data_) + begin, pos + n - begin, MADV_WILLNEED);
+#endif
+  }
+
+ private:
+  bool mapped_ = false;
+  void* data_ = nullptr;
+  int64_t size_ = 0;
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+// An output stream that writes a file as it goes.
+class FileOutStream {
+ public:
+  // Opens 'path' for writing, creating folders as needed.
+  explicit FileOutStream(const std::string& path) : path_(path) {
+    CreateParentDirs(path);
+    BreakHardLink(path);
+    s_.open(path, std::ios::out | std::ios::binary);
+    CHECK(s_.good(), "Failed to open for write '", path, "'");
+  }
+
+  // Appends data to the file.
+  void WriteData(std::string_view data) {
+    s_.write(data.data(), data.size());
+    CHECK(s_.good(), "Failed to write '", path_, "'");
+    TraceCount(TraceCounter::kBytesWritten, data.size());
+  }
+
+  // Flushes and closes the file.
+  void Close() {
+    s_.flush();
+    CHECK(s_.good(), "Failed to write '", path_, "'");
+    s_.close();
+  }
+
+ private:
+  std::ofstream s_;
+  std::string path_;
+};
+
 // An output stream backed by a std::vector.
 class VecOutStream {
  public:
@@ -0,0 +1,217 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_JSON_H_
+#define GT2_EXTRACT_JSON_H_
+
+#include <charconv>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "inspect.h"
+
+namespace gt2 {
+
+// Quotes and escapes 's' as a JSON string.
+inline std::string JsonQuote(std::string_view s) {
+  std::string out = "\"";
+  for (const char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out.push_back(c);
+        }
+    }
+  }
+  out.push_back('"');
+  return out;
+}
+
+// A small JSON reader, for manifests and the like.
+//  - Numbers are doubles. Objects keep their members in file order.
+//  - Malformed input FAILs, saying where.
+struct Json {
+  enum class Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+  Type type = Type::kNull;
+  bool boolean = false;
+  double number = 0;
+  std::string string;
+  std::vector<Json> array;
+  std::vector<std::pair<std::string, Json>> object;
+
+  bool is_null() const { return type == Type::kNull; }
+  bool is_array() const { return type == Type::kArray; }
+  bool is_object() const { return type == Type::kObject; }
+
+  // Member 'key' of an object, or null if there isn't one.
+  const Json* Find(std::string_view key) const {
+    for (const auto& kv : object) {
+      if (kv.first == key) return &kv.second;
+    }
+    return nullptr;
+  }
+
+  // Member 'key' as a string, or 'fallback' if missing.
+  std::string GetString(std::string_view key,
+                        std::string fallback = "") const {
+    const Json* j = Find(key);
+    if (!j) return fallback;
+    CHECK(j->type == Type::kString, "JSON '", key, "' should be a string.");
+    return j->string;
+  }
+
+  // Member 'key' as a bool, or 'fallback' if missing.
+  bool GetBool(std::string_view key, bool fallback = false) const {
+    const Json* j = Find(key);
+    if (!j) return fallback;
+    CHECK(j->type == Type::kBool, "JSON '", key, "' should be true or false.");
+    return j->boolean;
+  }
+
+  static Json FromString(std::string_view s) {
+    Parser p{s};
+    Json out = p.Value();
+    p.SkipSpace();
+    p.Check(p.i == s.size(), "trailing characters");
+    return out;
+  }
+
+ private:
+  struct Parser {
+    std::string_view s;
+    size_t i = 0;
+
+    void Check(bool ok, std::string_view what) const {
+      CHECK(ok, "Bad JSON at offset ", i, ": ", what);
+    }
+    void SkipSpace() {
+      while (i < s.size() &&
+             (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) {
+        ++i;
+      }
+    }
+    bool Consume(std::string_view token) {
+      if (s.substr(i, token.size()) != token) return false;
+      i += token.size();
+      return true;
+    }
+    void Expect(char c) {
+      SkipSpace();
+      Check(i < s.size() && s[i] == c, std::string("expected '") + c + "'");
+      ++i;
+    }
+
+    Json Value() {
+      SkipSpace();
+      Check(i < s.size(), "unexpected end");
+      Json out;
+      const char c = s[i];
+      if (c == '{') {
+        out.type = Type::kObject;
+        ++i;
+        SkipSpace();
+        if (Consume("}")) return out;
+        do {
+          SkipSpace();
+          std::string key = String();
+          Expect(':');
+          out.object.emplace_back(std::move(key), Value());
+          SkipSpace();
+        } while (Consume(","));
+        Expect('}');
+      } else if (c == '[') {
+        out.type = Type::kArray;
+        ++i;
+        SkipSpace();
+        if (Consume("]")) return out;
+        do {
+          out.array.push_back(Value());
+          SkipSpace();
+        } while (Consume(","));
+        Expect(']');
+      } else if (c == '"') {
+        out.type = Type::kString;
+        out.string = String();
+      } else if (Consume("true")) {
+        out.type = Type::kBool;
+        out.boolean = true;
+      } else if (Consume("false")) {
+        out.type = Type::kBool;
+      } else if (Consume("null")) {
+        out.type = Type::kNull;
+      } else {
+        out.type = Type::kNumber;
+        // from_chars doesn't take a leading '+', and neither does JSON.
+        const auto r = std::from_chars(s.data() + i, s.data() + s.size(),
+                                       out.number);
+        Check(r.ec == std::errc(), "expected a value");
+        i = r.ptr - s.data();
+      }
+      return out;
+    }
+
+    std::string String() {
+      Check(i < s.size() && s[i] == '"', "expected a string");
+      ++i;
+      std::string out;
+      while (true) {
+        Check(i < s.size(), "unterminated string");
+        const char c = s[i++];
+        if (c == '"') break;
+        if (c != '\\') {
+          out.push_back(c);
+          continue;
+        }
+        Check(i < s.size(), "unterminated string");
+        const char e = s[i++];
+        switch (e) {
+          case 'b': out.push_back('\b'); break;
+          case 'f': out.push_back('\f'); break;
+          case 'n': out.push_back('\n'); break;
+          case 'r': out.push_back('\r'); break;
+          case 't': out.push_back('\t'); break;
+          case 'u': {
+            // Paths are what we care about; keep it to one UTF-8 code unit
+            // sequence per escape, without surrogate pairs.
+            Check(i + 4 <= s.size(), "short \\u escape");
+            unsigned int code = 0;
+            const auto r = std::from_chars(s.data() + i, s.data() + i + 4,
+                                           code, 16);
+            Check(r.ptr == s.data() + i + 4, "bad \\u escape");
+            i += 4;
+            if (code < 0x80) {
+              out.push_back(code);
+            } else if (code < 0x800) {
+              out.push_back(0xC0 | (code >> 6));
+              out.push_back(0x80 | (code & 0x3F));
+            } else {
+              out.push_back(0xE0 | (code >> 12));
+              out.push_back(0x80 | ((code >> 6) & 0x3F));
+              out.push_back(0x80 | (code & 0x3F));
+            }
+            break;
+          }
+          default: out.push_back(e);  // '"', '\\' and '/'.
+        }
+      }
+      return out;
+    }
+  };
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_JSON_H_
@@ -0,0 +1,78 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_LRU_CACHE_H_
+#define GT2_EXTRACT_LRU_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace gt2 {
+
+// Blobs by name, bounded by their total size. The least recently used go
+// first when it's over budget.
+//  - Safe to call from any thread.
+//  - Blobs are shared, so one that's been evicted stays valid for whoever
+//    still holds it.
+class LruCache {
+ public:
+  using Blob = std::shared_ptr<const std::string>;
+
+  explicit LruCache(int64_t max_bytes) : max_bytes_(max_bytes) {}
+
+  LruCache(const LruCache&) = delete;
+  LruCache& operator=(const LruCache&) = delete;
+
+  // The blob called 'key', or null. Marks it as the most recently used.
+  Blob Get(std::string_view key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = index_.find(std::string(key));
+    if (it == index_.end()) return nullptr;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+
+  // Adds or replaces 'key', then evicts until the cache fits its budget.
+  void Put(std::string key, Blob blob) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = index_.find(key);
+    if (it != index_.end()) {
+      bytes_ -= it->second->second->size();
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+    bytes_ += blob->size();
+    entries_.emplace_front(key, std::move(blob));
+    index_.emplace(std::move(key), entries_.begin());
+    while (bytes_ > max_bytes_ && !entries_.empty()) {
+      bytes_ -= entries_.back().second->size();
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  // Total size of the cached blobs.
+  int64_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+ private:
+  using Entry = std::pair<std::string, Blob>;
+
+  const int64_t max_bytes_;
+  mutable std::mutex mutex_;
+  int64_t bytes_ = 0;
+  std::list<Entry> entries_;  // Most recently used first.
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_LRU_CACHE_H_
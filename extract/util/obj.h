@@ -4,17 +4,45 @@
 #ifndef GT2_OBJ_H_
 #define GT2_OBJ_H_
 
-// Extremely slow and unoptimized OBJ loading. Would not recommend general use.
+// Basic OBJ loading: positions, normals, UVs and faces. Everything else is
+// skipped.
 
+#include <charconv>
 #include <cstring>
-#include <sstream>
+#include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "inspect.h"
+#include "trace.h"
 #include "vec.h"
 
 namespace gt2 {
 
+// Removes and returns the next whitespace-separated token on an OBJ line.
+// Returns an empty token at the end of the line.
+inline std::string_view NextObjToken(std::string_view& line) {
+  constexpr std::string_view kSpace = " \t\r\f\v";
+  const size_t begin = line.find_first_not_of(kSpace);
+  if (begin == std::string_view::npos) {
+    line = {};
+    return {};
+  }
+  const size_t end = std::min(line.find_first_of(kSpace, begin), line.size());
+  const std::string_view token = line.substr(begin, end - begin);
+  line.remove_prefix(end);
+  return token;
+}
+
+// Parses a number from the whole token. Leaves 'out' alone if it can't.
+template <typename T>
+void ParseObjNumber(std::string_view token, T& out) {
+  // from_chars doesn't take a leading '+', unlike streams.
+  if (!token.empty() && token[0] == '+') token.remove_prefix(1);
+  std::from_chars(token.data(), token.data() + token.size(), out);
+}
+
 // One element of an OBJ face. E.g. '1/2/3' of 'f 1/2/3 4/5/6 7/8/9'.
 struct ObjFaceElement {
   int indices[3] = {0, 0, 0};
@@ -25,10 +53,12 @@ struct ObjFaceElement {
 
   static ObjFaceElement FromString(std::string_view element) {
     ObjFaceElement out;
-    auto tokens = Split(element, "/");
-    for (int i = 0; i < 3 && i < tokens.size(); ++i) {
-      std::stringstream ss((std::string(tokens[i])));
-      ss >> out.indices[i];
+    // Up to three '/' separated indices. Missing ones (as in '1//3') are zero.
+    for (int i = 0; i < 3; ++i) {
+      const size_t end = std::min(element.find('/'), element.size());
+      ParseObjNumber(element.substr(0, end), out.indices[i]);
+      if (end == element.size()) break;
+      element.remove_prefix(end + 1);
     }
     return out;
   }
@@ -90,46 +120,47 @@ struct Obj {
   std::vector<Vec2<float>> uvs;
   std::vector<ObjFace> faces;
 
-  static Obj FromString(const std::string& data) {
+  // Parses OBJ text in place, a line at a time, without copying any of it.
+  // Warnings about skipped lines go to 'log'.
+  static Obj FromString(std::string_view data, std::ostream& log = std::cerr) {
+    TraceScope trace("Obj::FromString");
     Obj o;
     o.verts.reserve(256);
     o.normals.reserve(512);
     o.uvs.reserve(512);
     o.faces.reserve(512);
 
-    std::stringstream ss(data);
-    std::string token;
-    ss >> token;
-    while (!token.empty()) {
+    while (!data.empty()) {
+      const size_t eol = std::min(data.find('\n'), data.size());
+      std::string_view line = data.substr(0, eol);
+      data.remove_prefix(std::min(eol + 1, data.size()));
+
+      const std::string_view token = NextObjToken(line);
+      if (token.empty()) continue;
+
       if (token == "v") {
-        Vec4<float> v;
-        v.w = 0;
-        ss >> v.x >> v.y >> v.z;
+        Vec4<float> v(0, 0, 0, 0);
+        ParseObjNumber(NextObjToken(line), v.x);
+        ParseObjNumber(NextObjToken(line), v.y);
+        ParseObjNumber(NextObjToken(line), v.z);
         o.verts.push_back(v);
-        if (!(ss >> token)) break;
       } else if (token == "vt") {
-        Vec2<float> uv;
-        ss >> uv.x >> uv.y;
+        Vec2<float> uv(0, 0);
+        ParseObjNumber(NextObjToken(line), uv.x);
+        ParseObjNumber(NextObjToken(line), uv.y);
         o.uvs.push_back(uv);
-        if (!(ss >> token)) break;
       } else if (token == "vn") {
-        Vec4<float> n;
-        n.w = 0;
-        ss >> n.x >> n.y >> n.z;
+        Vec4<float> n(0, 0, 0, 0);
+        ParseObjNumber(NextObjToken(line), n.x);
+        ParseObjNumber(NextObjToken(line), n.y);
+        ParseObjNumber(NextObjToken(line), n.z);
         o.normals.push_back(n);
-        if (!(ss >> token)) break;
       } else if (token == "f") {
-        std::string face_str;
-        std::getline(ss, face_str);
-
-        std::stringstream face_ss(face_str);
-        std::string a, b, c, d;
-        face_ss >> a >> b >> c >> d;
-
         ObjFace f;
-        f.elements[0] = ObjFaceElement::FromString(a);
-        f.elements[1] = ObjFaceElement::FromString(b);
-        f.elements[2] = ObjFaceElement::FromString(c);
+        f.elements[0] = ObjFaceElement::FromString(NextObjToken(line));
+        f.elements[1] = ObjFaceElement::FromString(NextObjToken(line));
+        f.elements[2] = ObjFaceElement::FromString(NextObjToken(line));
+        const std::string_view d = NextObjToken(line);
         if (d.empty()) {
           f.is_quad = false;
         } else {
@@ -137,13 +168,8 @@ struct Obj {
           f.elements[3] = ObjFaceElement::FromString(d);
         }
         o.faces.push_back(f);
-
-        if (!(ss >> token)) break;
       } else {
-        std::cerr << "Unknown token '" << token << "' skipping line."
-                  << std::endl;
-        std::getline(ss, token);
-        if (!(ss >> token)) break;
+        log << "Unknown token '" << token << "' skipping line." << std::endl;
       }
     }
 
@@ -0,0 +1,252 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_PATH_FILTER_H_
+#define GT2_EXTRACT_PATH_FILTER_H_
+
+#include <bitset>
+#include <cctype>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "inspect.h"
+
+namespace gt2 {
+
+// Matches paths against a pattern, compiled once up front.
+//  - Regex patterns built only from literals and ".*" (like ".*", "/car/.*" or
+//    ".*tsplr.*") are matched directly. Anything else falls back to std::regex.
+//  - Glob patterns support "*" (within one folder), "**" (across folders),
+//    "?", "[abc]", "[a-z]", "[!abc]" and "\" escapes. For instance
+//    "/car/*.cdo.gz" or "**/tsplr*".
+//  - Either way, the whole path must match. A malformed glob is an error.
+class PathFilter {
+ public:
+  enum class Syntax { kRegex, kGlob };
+
+  explicit PathFilter(const std::string& pattern,
+                      Syntax syntax = Syntax::kRegex) {
+    if (syntax == Syntax::kGlob) {
+      if (!ParseGlob(pattern)) FAIL("Bad glob '", pattern, "'");
+      Peel();
+    } else if (ParseRegex(pattern)) {
+      Peel();
+    } else {
+      regex_.emplace(pattern);
+    }
+  }
+
+  // True if the pattern needed the std::regex fallback.
+  bool uses_regex() const { return regex_.has_value(); }
+
+  // True if the whole 'path' matches the pattern.
+  bool Matches(std::string_view path) const {
+    if (regex_) return std::regex_match(path.begin(), path.end(), *regex_);
+
+    // Cheap checks on the literal ends first.
+    if (path.size() < min_size_) return false;
+    if (!StartsWith(path, prefix_) || !EndsWith(path, suffix_)) return false;
+    path.remove_prefix(prefix_.size());
+    path.remove_suffix(suffix_.size());
+
+    // Common shapes of what's left in the middle.
+    if (middle_.empty()) return path.empty();
+    if (middle_.size() == 1) {
+      if (middle_[0].kind == Token::kAnyRun) return true;
+      if (middle_[0].kind == Token::kStar) {
+        return path.find('/') == std::string_view::npos;
+      }
+    }
+    return MatchTokens(path);
+  }
+
+ private:
+  struct Token {
+    enum Kind {
+      kLiteral,  // Exactly 'text'.
+      kChar,     // One char from 'chars'.
+      kStar,     // Any run of chars, except '/'.
+      kAnyRun,   // Any run of chars.
+    };
+    Kind kind;
+    std::string text;
+    std::bitset<256> chars;
+  };
+
+  void AddLiteral(char c) {
+    if (tokens_.empty() || tokens_.back().kind != Token::kLiteral) {
+      tokens_.push_back({Token::kLiteral, "", {}});
+    }
+    tokens_.back().text.push_back(c);
+  }
+  void Add(Token::Kind kind, std::bitset<256> chars = {}) {
+    tokens_.push_back({kind, "", chars});
+  }
+
+  // Handles regexes made of literals, '\' escaped punctuation, '.' and '.*'.
+  // Returns false for anything else.
+  bool ParseRegex(std::string_view p) {
+    static constexpr std::string_view kSpecial = "^$|()[]{}*+?";
+    for (size_t i = 0; i < p.size(); ++i) {
+      const char c = p[i];
+      if (c == '\\') {
+        // Escaped letters and digits are classes or back-references.
+        if (i + 1 == p.size()) return false;
+        const unsigned char e = p[++i];
+        if (std::isalnum(e)) return false;
+        AddLiteral(e);
+      } else if (c == '.') {
+        // NOTE: '.' doesn't match line breaks, but VOL paths have none.
+        if (i + 1 < p.size() && p[i + 1] == '*') {
+          // Lazy or possessive repeats change nothing for a full match, but
+          // keep it simple.
+          if (i + 2 < p.size() && (p[i + 2] == '?' || p[i + 2] == '+')) {
+            return false;
+          }
+          ++i;
+          Add(Token::kAnyRun);
+        } else {
+          Add(Token::kChar, std::bitset<256>().set());
+        }
+      } else if (kSpecial.find(c) != std::string_view::npos) {
+        return false;
+      } else {
+        AddLiteral(c);
+      }
+    }
+    return true;
+  }
+
+  // Handles the glob syntax described above. Returns false if malformed.
+  bool ParseGlob(std::string_view p) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      const char c = p[i];
+      if (c == '\\') {
+        if (i + 1 == p.size()) return false;
+        AddLiteral(p[++i]);
+      } else if (c == '*') {
+        if (i + 1 < p.size() && p[i + 1] == '*') {
+          ++i;
+          Add(Token::kAnyRun);
+        } else {
+          Add(Token::kStar);
+        }
+      } else if (c == '?') {
+        Add(Token::kChar, std::bitset<256>().set().reset('/'));
+      } else if (c == '[') {
+        const size_t end = ParseClass(p, i);
+        if (end == std::string_view::npos) return false;
+        i = end;
+      } else {
+        AddLiteral(c);
+      }
+    }
+    return true;
+  }
+
+  // Parses the class starting with '[' at 'begin'. Returns the index of the
+  // closing ']', or npos if there isn't one.
+  size_t ParseClass(std::string_view p, size_t begin) {
+    size_t i = begin + 1;
+    const bool negate = (i < p.size() && (p[i] == '!' || p[i] == '^'));
+    if (negate) ++i;
+    std::bitset<256> chars;
+    // A ']' straight after the '[' is part of the class.
+    for (bool first = true; i < p.size() && (first || p[i] != ']');
+         ++i, first = false) {
+      const unsigned char lo = p[i];
+      if (i + 2 < p.size() && p[i + 1] == '-' && p[i + 2] != ']') {
+        const unsigned char hi = p[i + 2];
+        for (int k = lo; k <= hi; ++k) chars.set(k);
+        i += 2;
+      } else {
+        chars.set(lo);
+      }
+    }
+    if (i >= p.size()) return std::string_view::npos;
+    if (negate) chars.flip();
+    chars.reset('/');  // Globs never match across folders.
+    Add(Token::kChar, chars);
+    return i;
+  }
+
+  // Splits off literal ends, which are checked before anything else.
+  void Peel() {
+    size_t begin = 0, end = tokens_.size();
+    if (begin < end && tokens_[begin].kind == Token::kLiteral) {
+      prefix_ = tokens_[begin++].text;
+    }
+    if (begin < end && tokens_[end - 1].kind == Token::kLiteral) {
+      suffix_ = tokens_[--end].text;
+    }
+    middle_.assign(tokens_.begin() + begin, tokens_.begin() + end);
+    min_size_ = prefix_.size() + suffix_.size();
+    for (const Token& t : middle_) {
+      if (t.kind == Token::kLiteral) min_size_ += t.text.size();
+      if (t.kind == Token::kChar) min_size_ += 1;
+    }
+  }
+
+  // Tracks every position each token could end at. No backtracking, so it's
+  // O(tokens * path) whatever the pattern.
+  bool MatchTokens(std::string_view path) const {
+    const size_t n = path.size();
+    thread_local std::vector<char> now, next;
+    now.assign(n + 1, 0);
+    now[0] = 1;
+    for (const Token& t : middle_) {
+      next.assign(n + 1, 0);
+      bool any = false;
+      switch (t.kind) {
+        case Token::kLiteral:
+          for (size_t i = 0; i + t.text.size() <= n; ++i) {
+            if (now[i] && path.substr(i, t.text.size()) == t.text) {
+              next[i + t.text.size()] = 1;
+              any = true;
+            }
+          }
+          break;
+        case Token::kChar:
+          for (size_t i = 0; i < n; ++i) {
+            if (now[i] && t.chars[static_cast<unsigned char>(path[i])]) {
+              next[i + 1] = 1;
+              any = true;
+            }
+          }
+          break;
+        case Token::kStar:
+        case Token::kAnyRun: {
+          bool reach = false;
+          for (size_t i = 0; i <= n; ++i) {
+            reach = reach || now[i];
+            if (reach) {
+              next[i] = 1;
+              any = true;
+            }
+            if (t.kind == Token::kStar && i < n && path[i] == '/') {
+              reach = false;
+            }
+          }
+          break;
+        }
+      }
+      if (!any) return false;
+      now.swap(next);
+    }
+    return now[n];
+  }
+
+  std::vector<Token> tokens_;
+  std::string prefix_;
+  std::string suffix_;
+  std::vector<Token> middle_;
+  size_t min_size_ = 0;
+  std::optional<std::regex> regex_;
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_PATH_FILTER_H_
@@ -0,0 +1,185 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_THREAD_POOL_H_
+#define GT2_EXTRACT_THREAD_POOL_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "inspect.h"
+
+namespace gt2 {
+
+// A small work-stealing thread pool.
+//  - Each worker has its own queue, for the tasks submitted from that worker.
+//    Tasks submitted from outside the pool share one more queue.
+//  - Workers run their own newest task first, then the oldest task from
+//    outside, and steal the oldest task from another worker when they run
+//    dry. So tasks from outside start in the order they're submitted.
+//  - With one thread (or fewer), tasks run immediately in the caller, in the
+//    order they're submitted.
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(int num_threads)
+      : num_threads_(std::max(1, num_threads)) {
+    if (num_threads_ == 1) return;
+    queues_.reserve(num_threads_);
+    for (int i = 0; i < num_threads_; ++i) {
+      queues_.push_back(std::make_unique<Queue>());
+    }
+    threads_.reserve(num_threads_);
+    for (int i = 0; i < num_threads_; ++i) {
+      threads_.emplace_back([this, i] { WorkerLoop(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    Wait();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+  }
+
+  // Number of threads that run tasks.
+  int num_threads() const { return num_threads_; }
+
+  // Index of the worker running the current task, in [0, num_threads()).
+  // Zero outside of any pool, which is also where single-threaded pools run.
+  static int worker_index() { return WorkerIndex(); }
+
+  // Queues a task to run.
+  void Submit(Task task) {
+    if (num_threads_ == 1) {
+      task();
+      return;
+    }
+    // Counted before it's queued, so 'pending_' never drops to zero (or
+    // below) while it runs.
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++pending_;
+      ++queued_;
+    }
+    const bool inside = (current_pool() == this);
+    Queue& q = (inside ? *queues_[WorkerIndex()] : outside_);
+    {
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.tasks.push_back(std::move(task));
+    }
+    wake_.notify_one();
+  }
+
+  // Blocks until every submitted task has finished.
+  //  - Not from inside one of this pool's tasks: it would wait on itself. Use
+  //    another pool (e.g. ThreadPool(1), which runs tasks in the caller).
+  void Wait() {
+    CHECK(current_pool() != this, "ThreadPool::Wait from inside its own task.");
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  static int& WorkerIndex() {
+    static thread_local int index = 0;
+    return index;
+  }
+  static ThreadPool*& current_pool() {
+    static thread_local ThreadPool* pool = nullptr;
+    return pool;
+  }
+
+  // Takes the newest task from our own queue, or else the oldest from
+  // outside, or else the oldest from another worker.
+  bool TryPop(int self, Task& out) {
+    if (Pop(*queues_[self], /*newest=*/true, out)) return true;
+    if (Pop(outside_, /*newest=*/false, out)) return true;
+    for (int k = 1; k < num_threads_; ++k) {
+      if (Pop(*queues_[(self + k) % num_threads_], /*newest=*/false, out)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool Pop(Queue& q, bool newest, Task& out) {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    if (newest) {
+      out = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      out = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    return true;
+  }
+
+  void WorkerLoop(int self) {
+    WorkerIndex() = self;
+    current_pool() = this;
+    Task task;
+    while (true) {
+      if (TryPop(self, task)) {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          --queued_;
+        }
+        task();
+        task = nullptr;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) done_.notify_all();
+        continue;
+      }
+      // Sleep until something is queued. 'queued_' may briefly count a task
+      // that's still being pushed, or that another worker has already taken;
+      // then we just look again.
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+      if (stop_) return;
+    }
+  }
+
+  const int num_threads_;
+  std::vector<std::unique_ptr<Queue>> queues_;  // One per worker.
+  Queue outside_;  // Tasks submitted from outside the pool.
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;  // Guards everything below.
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  int64_t pending_ = 0;  // Submitted, but not finished.
+  int64_t queued_ = 0;   // Submitted, but not started.
+  bool stop_ = false;
+};
+
+// Runs 'fn(i)' for each i in [0, n) on the pool, and waits for all of them.
+// Like 'Wait', not from inside one of the pool's tasks.
+template <typename Fn>
+void ParallelFor(ThreadPool& pool, int64_t n, Fn&& fn) {
+  for (int64_t i = 0; i < n; ++i) pool.Submit([&fn, i] { fn(i); });
+  pool.Wait();
+}
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_THREAD_POOL_H_
@@ -0,0 +1,300 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_TRACE_H_
+#define GT2_EXTRACT_TRACE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "inspect.h"
+#include "json.h"
+
+namespace gt2 {
+
+// What 'TraceCount' counts.
+enum class TraceCounter { kBytesRead, kBytesInflated, kBytesWritten };
+constexpr int kNumTraceCounters = 3;
+constexpr const char* kTraceCounterNames[kNumTraceCounters] = {
+    "bytes_read", "bytes_inflated", "bytes_written"};
+
+// Scoped timers and byte counters, for finding where a run spends its time.
+//  - Does nothing until 'Enable()'. Until then, each scope or count costs one
+//    relaxed atomic load.
+//  - Each thread records into its own log, so recording never takes a lock.
+//  - Bytes count against the innermost open scope of the thread, and against
+//    the nearest open scope that names a file (its 'detail').
+//  - Read the results once the work is done: 'WriteStats' prints a summary,
+//    'WriteChromeTrace' makes a file for chrome://tracing or ui.perfetto.dev.
+class Tracer {
+ public:
+  static Tracer& Get() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  void Enable() {
+    start_ = Clock::now();
+    enabled_ = true;
+  }
+
+  // Opens a scope on this thread. Returns its event, for 'End'.
+  int Begin(const char* name, std::string_view detail) {
+    ThreadLog& log = Local();
+    const int parent = (log.open.empty() ? -1 : log.open.back());
+    const int event = log.events.size();
+    Event e{name, std::string(detail), parent};
+    e.file = (!detail.empty() || parent < 0 ? event : log.events[parent].file);
+    e.begin_ns = Now();
+    log.events.push_back(std::move(e));
+    log.open.push_back(event);
+    return event;
+  }
+
+  // Closes the innermost scope of this thread, which must be 'event'.
+  void End(int event) {
+    ThreadLog& log = Local();
+    CHECK(!log.open.empty() && log.open.back() == event);
+    log.events[event].end_ns = Now();
+    log.open.pop_back();
+  }
+
+  void Count(TraceCounter counter, int64_t n) {
+    ThreadLog& log = Local();
+    const int c = static_cast<int>(counter);
+    log.counts[c] += n;
+    if (!log.open.empty()) log.events[log.open.back()].counts[c] += n;
+  }
+
+  // Time per scope name, then bytes per thread and per file.
+  void WriteStats(std::ostream& os) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    struct Scope {
+      int64_t calls = 0;
+      int64_t total_ns = 0;
+      int64_t self_ns = 0;
+    };
+    std::map<std::string_view, Scope> scopes;
+    std::map<std::string_view, std::vector<int64_t>> files;
+    for (const auto& log : logs_) {
+      const std::vector<Event>& events = log->events;
+      for (const Event& e : events) {
+        Scope& s = scopes[e.name];
+        ++s.calls;
+        s.total_ns += Duration(e);
+        s.self_ns += Duration(e);
+        if (e.parent >= 0) scopes[events[e.parent].name].self_ns -= Duration(e);
+        if (e.file < 0 || events[e.file].detail.empty()) continue;
+        std::vector<int64_t>& f = files[events[e.file].detail];
+        f.resize(kNumTraceCounters);
+        for (int c = 0; c < kNumTraceCounters; ++c) f[c] += e.counts[c];
+      }
+    }
+
+    const auto ms = [](int64_t ns) { return ns / 1e6; };
+    os << std::fixed << std::setprecision(1) << "Stats: " << ms(Now())
+       << " ms since tracing began\n";
+    std::vector<std::pair<std::string_view, Scope>> by_self(scopes.begin(),
+                                                            scopes.end());
+    std::sort(by_self.begin(), by_self.end(), [](const auto& a, const auto& b) {
+      return a.second.self_ns > b.second.self_ns;
+    });
+    os << "  " << std::left << std::setw(36) << "scope" << std::right
+       << std::setw(9) << "calls" << std::setw(12) << "total ms"
+       << std::setw(12) << "self ms" << "\n";
+    for (const auto& [name, s] : by_self) {
+      os << "  " << std::left << std::setw(36) << name << std::right
+         << std::setw(9) << s.calls << std::setw(12) << ms(s.total_ns)
+         << std::setw(12) << ms(s.self_ns) << "\n";
+    }
+
+    const auto write_counts = [&os](std::string_view name,
+                                    const int64_t* counts) {
+      os << "  " << std::left << std::setw(36) << name << std::right;
+      for (int c = 0; c < kNumTraceCounters; ++c) {
+        os << std::setw(16) << counts[c];
+      }
+      os << "\n";
+    };
+    const auto write_header = [&os](std::string_view name) {
+      os << "  " << std::left << std::setw(36) << name << std::right;
+      for (const char* c : kTraceCounterNames) os << std::setw(16) << c;
+      os << "\n";
+    };
+    write_header("thread");
+    for (const auto& log : logs_) {
+      write_counts(StrCat("thread ", log->tid), log->counts);
+    }
+
+    // The busiest files. There may be thousands.
+    constexpr int kMaxFiles = 20;
+    const auto bytes = [](const std::vector<int64_t>& f) {
+      return f[0] + f[1] + f[2];
+    };
+    std::vector<std::pair<std::string_view, std::vector<int64_t>>> by_bytes;
+    for (const auto& f : files) {
+      if (bytes(f.second) > 0) by_bytes.push_back(f);
+    }
+    std::stable_sort(by_bytes.begin(), by_bytes.end(),
+                     [&](const auto& a, const auto& b) {
+                       return bytes(a.second) > bytes(b.second);
+                     });
+    write_header("file");
+    for (int i = 0; i < by_bytes.size() && i < kMaxFiles; ++i) {
+      write_counts(by_bytes[i].first, by_bytes[i].second.data());
+    }
+    if (by_bytes.size() > kMaxFiles) {
+      os << "  (" << by_bytes.size() - kMaxFiles << " more files)\n";
+    }
+    os << std::flush;
+  }
+
+  // Every scope as a complete ("X") event, in microseconds.
+  void WriteChromeTrace(std::ostream& os) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    os << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+    bool first = true;
+    for (const auto& log : logs_) {
+      os << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\""
+         << ", \"pid\": 1, \"tid\": " << log->tid
+         << ", \"args\": {\"name\": \"thread " << log->tid << "\"}}";
+      first = false;
+      for (const Event& e : log->events) {
+        os << ",\n{\"name\": " << JsonQuote(e.name)
+           << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << log->tid
+           << ", \"ts\": " << e.begin_ns / 1e3
+           << ", \"dur\": " << Duration(e) / 1e3 << ", \"args\": {";
+        bool first_arg = true;
+        if (!e.detail.empty()) {
+          os << "\"detail\": " << JsonQuote(e.detail);
+          first_arg = false;
+        }
+        for (int c = 0; c < kNumTraceCounters; ++c) {
+          if (!e.counts[c]) continue;
+          os << (first_arg ? "" : ", ") << "\"" << kTraceCounterNames[c]
+             << "\": " << e.counts[c];
+          first_arg = false;
+        }
+        os << "}}";
+      }
+    }
+    os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Event {
+    const char* name;
+    std::string detail;  // E.g. a file path.
+    int parent = -1;     // Enclosing event on the same thread.
+    int file = -1;       // This or the nearest enclosing event with a detail.
+    int64_t begin_ns = 0;
+    int64_t end_ns = -1;  // Still open.
+    int64_t counts[kNumTraceCounters] = {};
+  };
+
+  struct ThreadLog {
+    int tid = 0;  // In order of each thread's first event.
+    std::vector<Event> events;
+    std::vector<int> open;  // Events not yet ended, innermost last.
+    int64_t counts[kNumTraceCounters] = {};
+  };
+
+  ThreadLog& Local() {
+    thread_local ThreadLog* log = nullptr;
+    if (!log) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      logs_.push_back(std::make_unique<ThreadLog>());
+      log = logs_.back().get();
+      log->tid = logs_.size() - 1;
+    }
+    return *log;
+  }
+
+  int64_t Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start_)
+        .count();
+  }
+
+  // Scopes still open (e.g. the whole run) last until now.
+  int64_t Duration(const Event& e) const {
+    return (e.end_ns < 0 ? Now() : e.end_ns) - e.begin_ns;
+  }
+
+  inline static std::atomic<bool> enabled_{false};
+  Clock::time_point start_;
+  mutable std::mutex mutex_;  // Guards 'logs_' (not what's in them).
+  std::vector<std::unique_ptr<ThreadLog>> logs_;
+};
+
+// Times the rest of the enclosing scope, if tracing is on.
+//  - 'name' must outlive the run; use a literal.
+//  - 'detail' is copied, so it may be temporary.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name, std::string_view detail = {})
+      : event_(Tracer::enabled() ? Tracer::Get().Begin(name, detail) : -1) {}
+  ~TraceScope() {
+    if (event_ >= 0) Tracer::Get().End(event_);
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const int event_;
+};
+
+// Adds 'n' to a counter, if tracing is on.
+inline void TraceCount(TraceCounter counter, int64_t n) {
+  if (Tracer::enabled()) Tracer::Get().Count(counter, n);
+}
+
+// The tools' '--stats' and '--trace' flags. Tracing runs from construction:
+// the whole run is one scope, 'name'. On destruction, the summary goes to
+// stderr and the trace to 'trace_path'.
+class TraceSession {
+ public:
+  TraceSession(const char* name, bool stats, std::string trace_path)
+      : stats_(stats), trace_path_(std::move(trace_path)) {
+    if (stats_ || !trace_path_.empty()) Tracer::Get().Enable();
+    scope_ = std::make_unique<TraceScope>(name);
+  }
+  ~TraceSession() {
+    scope_.reset();
+    if (stats_) Tracer::Get().WriteStats(std::cerr);
+    if (!trace_path_.empty()) {
+      std::ofstream f(trace_path_, std::ios::out | std::ios::binary);
+      CHECK(f.good(), "Failed to open for write '", trace_path_, "'");
+      Tracer::Get().WriteChromeTrace(f);
+      CHECK(f.good(), "Failed to write '", trace_path_, "'");
+    }
+  }
+
+  TraceSession(const TraceSession&) = delete;
+  TraceSession& operator=(const TraceSession&) = delete;
+
+ private:
+  const bool stats_;
+  const std::string trace_path_;
+  std::unique_ptr<TraceScope> scope_;
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_TRACE_H_
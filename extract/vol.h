@@ -4,12 +4,16 @@
 #ifndef GT2_EXTRACT_VOL_H_
 #define GT2_EXTRACT_VOL_H_
 
+#include <algorithm>
 #include <cstring>
+#include <limits>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "util/inspect.h"
+#include "util/trace.h"
 
 namespace gt2 {
 
@@ -18,6 +22,9 @@ constexpr uint8_t kVolFlagEnd = 0x80;  // File is the last of its directory.
 
 constexpr int64_t kRootFolder = -1;
 
+// Files in the VOL begin on multiples of this many bytes.
+constexpr int64_t kVolAlignment = 2048;
+
 // Format of the main data file.
 struct Vol {
   struct Header {
@@ -60,6 +67,8 @@ struct Vol {
   struct File : public FileInfo {
     // Index into the vol's list of files. Points to a folder entry.
     int64_t parent = kRootFolder;
+    // Index of this file in the vol's list of files.
+    int64_t index = 0;
 
     // Byte position and size of the file.
     int64_t pos;
@@ -80,8 +89,185 @@ struct Vol {
       s.set_pos(pos);
       return s.ReadData(size);
     }
+
+    // Returns a bounded stream over the contents of the file, without copying.
+    // Requires a stream with View(), like MappedInStream.
+    template <typename Stream>
+    auto ViewContents(const Stream& s) const {
+      return s.View(pos, size);
+    }
+  };
+
+  // Full paths of every file, built once so lookups don't walk the hierarchy.
+  //  - All paths live in one string arena, indexed by File::index.
+  //  - Folder paths end in '/', e.g. the file "/car/a.cdo.gz" is in "/car/".
+  class PathIndex {
+   public:
+    PathIndex() = default;
+    // Copies must re-point the hash map at their own arena.
+    PathIndex(const PathIndex& p) : arena_(p.arena_), entries_(p.entries_) {
+      BuildMap();
+    }
+    PathIndex(PathIndex&&) = default;
+    PathIndex& operator=(const PathIndex& p) {
+      arena_ = p.arena_;
+      entries_ = p.entries_;
+      BuildMap();
+      return *this;
+    }
+    PathIndex& operator=(PathIndex&&) = default;
+
+    // Builds paths for 'files', which must list every folder before its
+    // contents (as ReadFolderHierarchy does).
+    explicit PathIndex(const std::vector<File>& files) {
+      entries_.reserve(files.size());
+      arena_.reserve(32 * files.size());
+      for (const File& f : files) {
+        const int64_t begin = arena_.size();
+        if (f.parent == kRootFolder) {
+          arena_.push_back('/');
+        } else {
+          // A folder's path is its parent's path plus its name.
+          CHECK_LT(f.parent, static_cast<int64_t>(entries_.size()));
+          const File& p = files[f.parent];
+          if (p.parent != kRootFolder) {
+            // NOTE: copied by index, since 'arena_' may reallocate.
+            const Entry& pe = entries_[f.parent];
+            for (int64_t j = 0; j < pe.dir_size; ++j) {
+              arena_.push_back(arena_[pe.begin + j]);
+            }
+          }
+          Append(p.name());
+          arena_.push_back('/');
+        }
+        const int64_t dir_size = arena_.size() - begin;
+        Append(f.name());
+        entries_.push_back({begin, dir_size,
+                            static_cast<int64_t>(arena_.size()) - begin});
+      }
+      BuildMap();
+    }
+
+    // Folder containing file 'i', e.g. "/car/".
+    std::string_view Dir(int64_t i) const {
+      const Entry& e = entries_[i];
+      return std::string_view(arena_.data() + e.begin, e.dir_size);
+    }
+    // Folder and name of file 'i', e.g. "/car/a.cdo.gz".
+    std::string_view Full(int64_t i) const {
+      const Entry& e = entries_[i];
+      return std::string_view(arena_.data() + e.begin, e.size);
+    }
+    // Index of the file with the given full path, or -1.
+    int64_t Find(std::string_view path) const {
+      const auto it = map_.find(path);
+      return it == map_.end() ? -1 : it->second;
+    }
+
+   private:
+    struct Entry {
+      int64_t begin;
+      int64_t dir_size;
+      int64_t size;
+    };
+
+    void Append(std::string_view s) {
+      arena_.insert(arena_.end(), s.begin(), s.end());
+    }
+
+    // Maps paths to indices. If a path repeats, the first file wins.
+    void BuildMap() {
+      map_.clear();
+      map_.reserve(entries_.size());
+      for (int64_t i = 0; i < entries_.size(); ++i) map_.emplace(Full(i), i);
+    }
+
+    // NOTE: a vector, so moves never invalidate the views in 'map_'.
+    std::vector<char> arena_;
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string_view, int64_t> map_;
   };
 
+  // A contiguous range of bytes in the VOL.
+  struct Extent {
+    int64_t pos = 0;
+    int64_t size = 0;
+    int64_t end() const { return pos + size; }
+  };
+
+  // A group of jobs, and the extents of the VOL they read.
+  struct ReadBatch {
+    std::vector<int64_t> jobs;    // Indices of jobs passed to PlanReads.
+    std::vector<Extent> extents;  // Sorted and merged; one read each.
+    int64_t bytes = 0;            // Total bytes in 'extents'.
+  };
+
+  // Plans the order in which to run 'jobs', each of which reads some files.
+  //  - Jobs are sorted by the position of their first file, so the VOL is
+  //    read front-to-back instead of in directory order.
+  //  - Consecutive jobs are batched until a batch reads 'batch_bytes'.
+  //  - Within a batch, files that touch (after 2048-byte alignment) become a
+  //    single extent, so each batch is a few large, sequential reads.
+  static std::vector<ReadBatch> PlanReads(
+      const std::vector<std::vector<const File*>>& jobs, int64_t batch_bytes) {
+    const auto first_pos = [&](int64_t i) {
+      int64_t pos = std::numeric_limits<int64_t>::max();
+      for (const File* f : jobs[i]) pos = std::min(pos, f->pos);
+      return pos;
+    };
+
+    std::vector<int64_t> order(jobs.size());
+    for (int64_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b) {
+      return first_pos(a) < first_pos(b);
+    });
+
+    std::vector<ReadBatch> out;
+    int64_t unmerged_bytes = 0;
+    for (int64_t k = 0; k < order.size(); ++k) {
+      if (out.empty() || unmerged_bytes >= batch_bytes) {
+        out.push_back({});
+        unmerged_bytes = 0;
+      }
+      ReadBatch& batch = out.back();
+      batch.jobs.push_back(order[k]);
+      for (const File* f : jobs[order[k]]) {
+        if (f->size <= 0) continue;
+        batch.extents.push_back({f->pos, f->size});
+        unmerged_bytes += f->size;
+      }
+    }
+    for (ReadBatch& batch : out) batch.bytes = MergeExtents(batch.extents);
+    return out;
+  }
+
+  // Sorts and merges extents that overlap or touch after alignment.
+  // Returns the total size of the merged extents.
+  static int64_t MergeExtents(std::vector<Extent>& v) {
+    std::sort(v.begin(), v.end(), [](const Extent& a, const Extent& b) {
+      return a.pos < b.pos;
+    });
+    int64_t n = 0;
+    int64_t bytes = 0;
+    for (const Extent& e : v) {
+      if (n > 0) {
+        Extent& last = v[n - 1];
+        const int64_t aligned_end =
+            (last.end() + kVolAlignment - 1) / kVolAlignment * kVolAlignment;
+        if (e.pos <= aligned_end) {
+          const int64_t end = std::max(last.end(), e.end());
+          bytes += end - last.end();
+          last.size = end - last.pos;
+          continue;
+        }
+      }
+      v[n++] = e;
+      bytes += e.size;
+    }
+    v.resize(n);
+    return bytes;
+  }
+
   // As-written in the VOL.
   Header header;
   std::vector<Offset> offsets;
@@ -89,6 +275,7 @@ struct Vol {
   // Derived, upon loading.
   int64_t total_size;
   std::vector<File> files;
+  PathIndex paths;
 
   // Computes the position of the given file.
   int32_t PositionOf(const FileInfo& f) const {
@@ -111,14 +298,28 @@ struct Vol {
     return 0;
   }
 
-  // Returns the path of the given file.
-  std::string PathOf(File f) const {
-    if (f.parent == kRootFolder) return "/";
-    std::string out;
-    do {
-      f = files[f.parent];
-      out = std::string(f.name()) + "/" + out;
-    } while (f.parent != kRootFolder);
+  // Returns the path of the folder containing the given file.
+  std::string_view PathOf(const File& f) const { return paths.Dir(f.index); }
+
+  // Returns the path and name of the given file.
+  std::string_view FullPathOf(const File& f) const {
+    return paths.Full(f.index);
+  }
+
+  // Finds the file with the given path and name. Returns nullptr if missing.
+  const File* FindFile(std::string_view path) const {
+    const int64_t i = paths.Find(path);
+    return i < 0 ? nullptr : &files[i];
+  }
+
+  // Entries whose full path matches 'filter' (e.g. a PathFilter), in order.
+  //  - Runs over the cached path table, so no paths are built.
+  template <typename Filter>
+  std::vector<const File*> Select(const Filter& filter) const {
+    std::vector<const File*> out;
+    for (int64_t i = 0; i < static_cast<int64_t>(files.size()); ++i) {
+      if (filter.Matches(paths.Full(i))) out.push_back(&files[i]);
+    }
     return out;
   }
 
@@ -166,6 +367,7 @@ struct Vol {
 
       // Set derived fields.
       f.parent = dirs[stack.back().current];
+      f.index = i;
       f.pos = this->PositionOf(info);
       f.size = this->SizeOf(info);
 
@@ -197,6 +399,7 @@ struct Vol {
 
   template <typename Stream>
   static Vol FromStream(Stream& s) {
+    TraceScope trace("Vol::FromStream");
     const int64_t init_pos = s.pos();
 
     Vol out;
@@ -228,6 +431,7 @@ struct Vol {
 
     // Compute the folder structure from data we read above.
     out.files = out.ReadFolderHierarchy();
+    out.paths = PathIndex(out.files);
 
     return out;
   }
@@ -0,0 +1,169 @@
+// Copyright (c) 2021 commongear
+// MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
+
+#ifndef GT2_EXTRACT_VOL_WRITER_H_
+#define GT2_EXTRACT_VOL_WRITER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/inspect.h"
+#include "util/io.h"
+#include "util/trace.h"
+#include "vol.h"
+
+namespace gt2 {
+
+// Replaces the contents of entries in a VOL file, without rewriting the rest.
+//  - If the new data fits the entry's extent (the 2048-byte-aligned span up to
+//    the next entry, less at most 2047 bytes of 'pad'), it overwrites the old
+//    data, and only the entry's offset changes.
+//  - Otherwise the data is appended, and the entry moves there under a new
+//    offset. Its old extent is left unused, so the VOL grows by the new data.
+//  - Entries that share their data with another are always moved, so the
+//    other doesn't change too.
+//  - The VOL mustn't be mapped (e.g. by a MappedInStream) while writing.
+class VolWriter {
+ public:
+  // What 'Replace' did.
+  struct Patch {
+    bool in_place = false;
+    int64_t pos = 0;            // Where the data went.
+    int64_t bytes_written = 0;  // Including the tables.
+  };
+
+  // Opens the VOL at 'path' for reading and writing.
+  explicit VolWriter(std::string path)
+      : path_(std::move(path)),
+        file_(path_, std::ios::in | std::ios::out | std::ios::binary) {
+    CHECK(file_.good(), "Failed to open for write '", path_, "'");
+    Reload();
+  }
+
+  VolWriter(const VolWriter&) = delete;
+  VolWriter& operator=(const VolWriter&) = delete;
+
+  // The VOL as it is now, with any patches.
+  const Vol& vol() const { return vol_; }
+
+  // Replaces the entry with full path 'vol_path' (e.g. "/car/a.cdo.gz") with
+  // 'data', as-is: gzip it first if the entry is gzipped.
+  Patch Replace(std::string_view vol_path, std::string_view data) {
+    TraceScope trace("VolWriter::Replace", vol_path);
+    const Vol::File* found = vol_.FindFile(vol_path);
+    CHECK(found, "No '", vol_path, "' in the VOL.");
+    const Vol::File f = *found;
+    CHECK(!f.is_dir(), "'", vol_path, "' is a folder.");
+    const int64_t k = f.offset_index;
+    // Offsets 0 and 1 locate the tables.
+    CHECK(2 <= k && k < vol_.offsets.size(), "'", vol_path,
+          "' has no data of its own to replace.");
+
+    bool shared = false;
+    for (const Vol::File& g : vol_.files) {
+      if (g.index != f.index && g.offset_index == k) shared = true;
+    }
+
+    std::vector<Vol::Offset> offsets = vol_.offsets;
+    const int64_t pos = offsets[k].pos();
+    const int64_t size = data.size();
+    // The last entry runs to the end of the VOL, so it always fits.
+    const bool last = (k + 1 == offsets.size());
+    const int64_t pad = (last ? 0 : offsets[k + 1].pos() - pos - size);
+    bytes_written_ = 0;
+
+    Patch out;
+    if (!shared && 0 <= pad && pad < kVolAlignment) {
+      out.in_place = true;
+      out.pos = pos;
+      Write(pos, data);
+      Write(pos + size, std::string(pad, '\0'));
+      if (last) Resize(pos + size);
+      offsets[k].value = pos | pad;
+    } else {
+      CHECK_GE(offsets[0].pad(), sizeof(Vol::Offset),
+               "The VOL's offset table has no room to move '", vol_path,
+               "'. The VOL needs rebuilding.");
+      CHECK_LT(offsets.size(), std::numeric_limits<int16_t>::max());
+      const int64_t end = vol_.total_size;
+      out.pos = (end + kVolAlignment - 1) / kVolAlignment * kVolAlignment;
+      CHECK_LE(out.pos + size, std::numeric_limits<uint32_t>::max(),
+               "The VOL would be too big.");
+
+      // The entry that was last now ends at 'out.pos'. Its pad grows by the
+      // gap, so its size doesn't change.
+      Vol::Offset& prev = offsets.back();
+      CHECK_LT(prev.pad() + out.pos - end, kVolAlignment);
+      prev.value += out.pos - end;
+      // The table grows into its own pad.
+      offsets[0].value -= sizeof(Vol::Offset);
+      offsets.push_back({static_cast<uint32_t>(out.pos)});
+
+      Write(end, std::string(out.pos - end, '\0'));
+      Write(out.pos, data);
+
+      Vol::FileInfo info = vol_.file_infos[f.index];
+      info.offset_index = offsets.size() - 1;
+      Write(offsets[1].pos() + f.index * sizeof(info), AsBytes(info));
+      Vol::Header header = vol_.header;
+      header.num_offsets = offsets.size();
+      Write(0, AsBytes(header));
+    }
+    Write(0x10, std::string_view(reinterpret_cast<const char*>(offsets.data()),
+                                 offsets.size() * sizeof(Vol::Offset)));
+    file_.flush();
+    CHECK(file_.good(), "Failed to write '", path_, "'");
+    out.bytes_written = bytes_written_;
+
+    // Make sure it reads back.
+    Reload();
+    const Vol::File* patched = vol_.FindFile(vol_path);
+    CHECK(patched && patched->pos == out.pos && patched->size == size,
+          "Patched '", vol_path, "' but it doesn't read back.");
+    FileInStream s(path_);
+    CHECK(patched->ReadContents(s) == data, "Patched '", vol_path,
+          "' but its contents don't read back.");
+    return out;
+  }
+
+ private:
+  template <typename T>
+  static std::string_view AsBytes(const T& t) {
+    return std::string_view(reinterpret_cast<const char*>(&t), sizeof(t));
+  }
+
+  void Reload() {
+    FileInStream s(path_);
+    CHECK(s.ok(), "Failed to open '", path_, "'");
+    vol_ = Vol::FromStream(s);
+  }
+
+  void Write(int64_t pos, std::string_view data) {
+    file_.seekp(pos);
+    file_.write(data.data(), data.size());
+    CHECK(file_.good(), "Failed to write '", path_, "'");
+    bytes_written_ += data.size();
+    TraceCount(TraceCounter::kBytesWritten, data.size());
+  }
+
+  void Resize(int64_t size) {
+    file_.flush();
+    std::error_code error;
+    std::filesystem::resize_file(path_, size, error);
+    CHECK(!error, "Failed to resize '", path_, "': ", error.message());
+  }
+
+  const std::string path_;
+  std::fstream file_;
+  Vol vol_;
+  int64_t bytes_written_ = 0;
+};
+
+}  // namespace gt2
+
+#endif  // GT2_EXTRACT_VOL_WRITER_H_
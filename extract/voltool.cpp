@@ -1,17 +1,28 @@
 // Copyright (c) 2021 commongear
 // MIT License (see https://github.com/commongear/gt2/blob/master/LICENSE)
 
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
-#include <regex>
+#include <map>
+#include <mutex>
+#include <set>
 
 #define STBI_ASSERT(x) CHECK(x)
 
 #include "car.h"
 #include "car_to_obj.h"
+#include "util/args.h"
 #include "util/gzip.h"
+#include "util/http.h"
 #include "util/io.h"
+#include "util/json.h"
+#include "util/lru_cache.h"
+#include "util/path_filter.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 #include "vol.h"
+#include "vol_writer.h"
 
 namespace miniz {
 #include "3p/miniz/miniz.c"
@@ -25,13 +36,58 @@ using namespace gt2;
 // If 'true', GZip files will be unpacked when extracting from the vol.
 constexpr bool kAutoUnpackGz = true;
 
+// Extraction reads the VOL in batches of about this many bytes.
+constexpr int64_t kReadBatchBytes = 16 << 20;
+
+// Bump this when 'get' or 'getobjs' would write something different for the
+// same input, so '--sync' redoes everything.
+constexpr int kToolVersion = 1;
+
 static constexpr char kUsage[] =
-"Usage:  voltool path-to-vol command [args...]\n"
+"Usage:  voltool path-to-vol command [args...] [options...]\n"
 "  path-to-vol:  path and filename of the VOL to load\n"
-"  command:      [dirs, list, get, getobjs, getobjs-nowheels, inspect]\n"
+"  command:      [dirs, list, get, getobjs, getobjs-nowheels, getglb,\n"
+"                inspect, serve, patch]\n"
 "                details below\n"
 "  args...:      command arguments; details below\n"
 "\n"
+"Options:\n"
+"  -j N\n"
+"    Number of threads to use for 'get', 'getobjs' and 'serve' (default 1).\n"
+"  --indexed-png\n"
+"    Writes the palette, texture and brake light PNGs with indexed color\n"
+"    (smaller files, same pixels).\n"
+"  --profile minimal|viewer|debug|gpu\n"
+"    Which files 'getobjs' and 'getglb' write (default debug).\n"
+"      minimal:  models, materials, o.json and the first skin\n"
+"      viewer:   plus every skin and its brake lights\n"
+"      debug:    plus palettes, flags and UV debugging images\n"
+"      gpu:      models, materials, o.json, an index texture and a strip of\n"
+"                every palette, for the viewer to decode on the GPU\n"
+"  --padding N\n"
+"    Texels to grow textures by around their UVs, which hides seams\n"
+"    (default 1).\n"
+"  --cache-mb N\n"
+"    Memory for converted files in 'serve' (default 256).\n"
+"  --sync\n"
+"    For 'get', 'getobjs' and 'getglb': skips entries that haven't changed\n"
+"    since the last run into the same output-path, and whose outputs are\n"
+"    still there. What was done is kept in output-path/.voltool-COMMAND.json.\n"
+"  --dedupe\n"
+"    For 'get', 'getobjs' and 'getglb': entries with the same raw bytes as an\n"
+"    earlier one are extracted once, and hard links (or copies) made for the\n"
+"    rest.\n"
+"  --glob\n"
+"    Patterns are globs instead of regexes: '*' matches within a folder, '**'\n"
+"    across folders, '?' one character, '[a-z]' a set of characters.\n"
+"    For instance \"voltool some.VOL list '/car/*.cdo.gz' --glob\".\n"
+"  --stats\n"
+"    Prints where the time went when the command finishes: time per stage,\n"
+"    and bytes read, inflated and written per thread and per file.\n"
+"  --trace path\n"
+"    Writes the same as a Chrome trace, for chrome://tracing or\n"
+"    ui.perfetto.dev, when the command finishes ('serve' never does).\n"
+"\n"
 "Commands:\n"
 "  dirs\n"
 "    Lists the folders in the VOL.\n"
@@ -59,213 +115,917 @@ static constexpr char kUsage[] =
 "    output-path:    folder in which to store extracted files\n"
 "    regex-pattern:  standard c++ regex\n"
 "  getobjs-nowheels output-path regex-pattern\n"
-"    Same as above, but doesn't build wheels for the model.";
+"    Same as above, but doesn't build wheels for the model.\n"
+"  getglb output-path regex-pattern\n"
+"    Like getobjs, but writes one binary glTF (GLB) per car, with every LOD\n"
+"      and the textures inside.\n"
+"  serve :port [static-path]\n"
+"    Serves the cars in the VOL to the viewer over HTTP on 127.0.0.1,\n"
+"      converting each the first time it's asked for. '--profile viewer'\n"
+"      (or gpu) skips the debugging images the viewer doesn't use.\n"
+"    port:           for instance ':8080'\n"
+"    static-path:    folder for everything outside /models/, e.g. '../view'.\n"
+"    For instance \"voltool some.VOL serve :8080 ../view\", then browse to\n"
+"      http://127.0.0.1:8080/main.html.\n"
+"  patch vol-path file\n"
+"    Replaces one file in the VOL with a local one, e.g. a car from\n"
+"      'cdotool packcdo'. It's gzipped first if the VOL's file is and it\n"
+"      isn't. Written in place if it fits where the old one was; otherwise\n"
+"      appended to the VOL, leaving the old bytes unused.\n"
+"    vol-path:       full path in the VOL, e.g. '/car/abc.cdo.gz'\n"
+"    file:           the new contents";
 
 // Prints the usage message.
 void PrintUsage() {
   std::cerr << kUsage << std::endl;
 }
 
+// Prints a line to stdout. Safe to call from any thread.
+template <typename... T>
+void Log(T&&... args) {
+  static std::mutex mutex;
+  const std::string line = StrCat(args...);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::cout << line << std::endl;
+}
+
 // Extracts the contents of an optionally zipped file.
-std::string GetFileContents(FileInStream& s, const Vol::File& f, bool unzip) {
+std::string GetFileContents(const MappedInStream& s, const Vol::File& f,
+                            bool unzip, Inflater* inflater = nullptr) {
+  TraceScope trace("GetFileContents", f.name());
+  ViewInStream file = f.ViewContents(s);
+  TraceCount(TraceCounter::kBytesRead, file.size());
   if (unzip) {
-    StringInStream file(f.ReadContents(s));
-    return GzipMember::FromStream(file).inflated;
+    return GzipMember::FromStream(file, inflater).inflated;
   } else {
-    return f.ReadContents(s);
+    return std::string(file.data());
+  }
+}
+
+// One VOL entry that a job reads, as a '--sync' manifest records it.
+struct SyncInput {
+  std::string path;
+  int64_t datetime = 0;
+  int64_t pos = 0;
+  int64_t size = 0;
+  int64_t crc = 0;  // From the gzip footer, or of the raw bytes otherwise.
+
+  bool operator==(const SyncInput& o) const {
+    return path == o.path && datetime == o.datetime && pos == o.pos &&
+           size == o.size && crc == o.crc;
+  }
+};
+
+// How 'f' looks now. Cheap for gzipped entries: only the footer is read.
+SyncInput SyncInputOf(const MappedInStream& s, const Vol& vol,
+                      const Vol::File& f) {
+  SyncInput out;
+  out.path = vol.FullPathOf(f);
+  out.datetime = f.datetime;
+  out.pos = f.pos;
+  out.size = f.size;
+  const std::string_view data = f.ViewContents(s).data();
+  if (EndsWith(out.path, ".gz") && data.size() >= sizeof(GzipMember::Footer)) {
+    GzipMember::Footer footer;
+    std::memcpy(&footer, data.data() + data.size() - sizeof(footer),
+                sizeof(footer));
+    out.crc = footer.crc;
+  } else {
+    out.crc = Crc32(data);
+  }
+  return out;
+}
+
+// What 'get' or 'getobjs' did for each entry last time ('--sync').
+//  - Kept in 'output-path/.voltool-<command>.json', with the VOL's path and
+//    the tool version. If either of those changed, nothing is up to date.
+//  - Entries this run doesn't touch keep their records.
+class SyncManifest {
+ public:
+  struct Entry {
+    std::vector<SyncInput> inputs;
+    std::string settings;  // Options that change the outputs.
+    // Outputs, relative to the output path, and their sizes.
+    std::vector<std::pair<std::string, int64_t>> outputs;
+  };
+
+  SyncManifest(std::string out_path, std::string_view command,
+               std::string vol_path)
+      : out_path_(std::move(out_path)),
+        path_((std::filesystem::path(out_path_) /
+               StrCat(".voltool-", command, ".json"))
+                  .generic_string()),
+        vol_path_(std::move(vol_path)) {
+    if (!std::filesystem::exists(path_)) return;
+    const Json json = Json::FromString(Load(path_));
+    const Json* version = json.Find("tool_version");
+    if (!version || version->number != kToolVersion ||
+        json.GetString("vol") != vol_path_) {
+      return;
+    }
+    const Json* entries = json.Find("entries");
+    if (!entries) return;
+    for (const auto& [key, e] : entries->object) {
+      Entry& entry = entries_[key];
+      entry.settings = e.GetString("settings");
+      if (const Json* inputs = e.Find("inputs")) {
+        for (const Json& in : inputs->array) {
+          const auto number = [&](std::string_view k) -> int64_t {
+            const Json* j = in.Find(k);
+            return j ? j->number : -1;
+          };
+          entry.inputs.push_back({in.GetString("path"), number("datetime"),
+                                  number("pos"), number("size"),
+                                  number("crc")});
+        }
+      }
+      if (const Json* outputs = e.Find("outputs")) {
+        for (const auto& [name, size] : outputs->object) {
+          entry.outputs.emplace_back(name, size.number);
+        }
+      }
+    }
+  }
+
+  // True if 'key' was done last time from the same inputs and settings, and
+  // its outputs are still there at the same sizes.
+  bool UpToDate(const std::string& key, const std::vector<SyncInput>& inputs,
+                const std::string& settings) const {
+    const auto it = entries_.find(key);
+    if (it == entries_.end()) return false;
+    const Entry& e = it->second;
+    if (e.inputs != inputs || e.settings != settings || e.outputs.empty()) {
+      return false;
+    }
+    for (const auto& [name, size] : e.outputs) {
+      std::error_code error;
+      const auto actual = std::filesystem::file_size(out_path_ + name, error);
+      if (error || actual != size) return false;
+    }
+    return true;
+  }
+
+  // Records what a job did. Safe to call from any thread.
+  void Set(const std::string& key, Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[key] = std::move(entry);
+  }
+
+  // Writes the manifest out.
+  void Save() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out = StrCat("{\n  \"tool_version\": ", kToolVersion,
+                             ",\n  \"vol\": ", JsonQuote(vol_path_),
+                             ",\n  \"entries\": {");
+    const char* sep = "\n";
+    for (const auto& [key, e] : entries_) {
+      out += StrCat(sep, "    ", JsonQuote(key), ": {\"settings\": ",
+                    JsonQuote(e.settings), ", \"inputs\": [");
+      for (int i = 0; i < e.inputs.size(); ++i) {
+        const SyncInput& in = e.inputs[i];
+        out += StrCat(i > 0 ? ", " : "", "{\"path\": ", JsonQuote(in.path),
+                      ", \"datetime\": ", in.datetime, ", \"pos\": ", in.pos,
+                      ", \"size\": ", in.size, ", \"crc\": ", in.crc, "}");
+      }
+      out += "], \"outputs\": {";
+      for (int i = 0; i < e.outputs.size(); ++i) {
+        out += StrCat(i > 0 ? ", " : "", JsonQuote(e.outputs[i].first), ": ",
+                      e.outputs[i].second);
+      }
+      out += "}}";
+      sep = ",\n";
+    }
+    // Replaced in one go, so an interrupted run leaves the old one.
+    const std::string tmp = path_ + ".tmp";
+    gt2::Save(out + "\n  }\n}\n", tmp);
+    std::filesystem::rename(tmp, path_);
+  }
+
+ private:
+  const std::string out_path_;
+  const std::string path_;
+  const std::string vol_path_;
+  std::map<std::string, Entry> entries_;
+  mutable std::mutex mutex_;
+};
+
+// Finds VOL entries with the same raw (compressed) bytes, for '--dedupe'.
+//  - Bytes are hashed straight from the mapping, and compared in full when
+//    the hashes match, so a collision can't merge different files.
+//  - Gzipped and plain entries are never the same: they extract differently.
+class DedupeIndex {
+ public:
+  explicit DedupeIndex(const MappedInStream& s, const Vol& vol)
+      : s_(s), vol_(vol) {}
+
+  // The first file given with the same contents as 'f', or 'f' itself.
+  const Vol::File& Canonical(const Vol::File& f) {
+    const std::string_view data = f.ViewContents(s_).data();
+    const bool gz = EndsWith(vol_.FullPathOf(f), ".gz");
+    std::vector<const Vol::File*>& same_hash =
+        files_[std::hash<std::string_view>()(data) ^ gz];
+    for (const Vol::File* other : same_hash) {
+      if (other == &f) return f;
+      if (gz == EndsWith(vol_.FullPathOf(*other), ".gz") &&
+          data == other->ViewContents(s_).data()) {
+        num_bytes_ += f.size;
+        return *other;
+      }
+    }
+    same_hash.push_back(&f);
+    return f;
   }
+
+  // Compressed bytes of the duplicates found so far.
+  int64_t num_bytes() const { return num_bytes_; }
+
+ private:
+  const MappedInStream& s_;
+  const Vol& vol_;
+  std::unordered_map<size_t, std::vector<const Vol::File*>> files_;
+  int64_t num_bytes_ = 0;
+};
+
+// Hard-links 'to' to 'from', or copies it where links can't be made.
+void LinkOrCopy(const std::string& from, const std::string& to) {
+  CreateParentDirs(to);
+  std::error_code error;
+  std::filesystem::remove(to, error);
+  std::filesystem::create_hard_link(from, to, error);
+  if (!error) return;
+  std::filesystem::copy_file(from, to, error);
+  CHECK(!error, "Failed to copy '", from, "' to '", to, "': ", error.message());
 }
 
-// Scans the index for the file with the given path.
-const Vol::File* FindFile(const Vol& v, std::string_view path) {
-  for (const auto& f : v.files) {
-    if (StrCat(v.PathOf(f), f.name()) == path) return &f;
+// Prints how much '--dedupe' saved.
+void FinishDedupe(const DedupeIndex* dedupe, int num_duplicates) {
+  if (!dedupe) return;
+  Log("Dedupe: ", num_duplicates, " duplicates linked instead of extracted (",
+      dedupe->num_bytes() / 1024, " KiB of input).");
+}
+
+// Work to do on some files from the VOL.
+struct Job {
+  std::vector<const Vol::File*> reads;  // Files this job will read.
+  ThreadPool::Task run;
+};
+
+// Runs jobs in the order of the data they read from the VOL.
+//  - Jobs are batched (see Vol::PlanReads). The reads for each batch are
+//    prefetched in the background as the batch before it is submitted.
+//  - Batches overlap: the next is submitted while the last one's stragglers
+//    finish, so workers don't idle at the end of each batch. At most two are
+//    in flight at once, which bounds memory use.
+void RunJobs(const MappedInStream& s, std::vector<Job>& jobs,
+             ThreadPool& pool) {
+  std::vector<std::vector<const Vol::File*>> reads;
+  reads.reserve(jobs.size());
+  for (const Job& j : jobs) reads.push_back(j.reads);
+  const std::vector<Vol::ReadBatch> plan =
+      Vol::PlanReads(reads, kReadBatchBytes);
+
+  const auto prefetch = [&](int64_t b) {
+    if (b >= plan.size()) return;
+    for (const Vol::Extent& e : plan[b].extents) s.Prefetch(e.pos, e.size);
+  };
+
+  // Jobs not yet finished in each batch.
+  std::vector<int64_t> unfinished(plan.size());
+  for (int64_t b = 0; b < plan.size(); ++b) {
+    unfinished[b] = plan[b].jobs.size();
+  }
+  std::mutex mutex;  // Guards 'unfinished'.
+  std::condition_variable batch_done;
+
+  prefetch(0);
+  for (int64_t b = 0; b < plan.size(); ++b) {
+    if (b >= 2) {
+      std::unique_lock<std::mutex> lock(mutex);
+      batch_done.wait(lock, [&] { return unfinished[b - 2] == 0; });
+    }
+    prefetch(b + 1);
+    for (const int64_t i : plan[b].jobs) {
+      pool.Submit([&, b, i] {
+        jobs[i].run();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--unfinished[b] == 0) batch_done.notify_all();
+      });
+    }
   }
-  return nullptr;
+  pool.Wait();
 }
 
 // List dirs from the VOL.
 void ListDirs(const Vol& vol) {
   for (const auto& f : vol.files) {
     if (f.is_dir()) {
-      const std::string path = vol.PathOf(f);
-      std::cout << std::left << std::setw(12) << path << f << std::endl;
+      std::cout << std::left << std::setw(12) << vol.PathOf(f) << f
+                << std::endl;
     }
   }
 }
 
 // List files from the VOL.
-void ListFiles(const Vol& vol, const std::string& pattern) {
-  const std::regex regex(pattern);
-  for (const auto& f : vol.files) {
-    const std::string path = vol.PathOf(f);
-    const std::string full_name = path + std::string(f.name());
-    if (std::regex_match(full_name, regex)) {
-      std::cout << std::left << std::setw(12) << path << f << std::endl;
-    }
+void ListFiles(const Vol& vol, const PathFilter& filter) {
+  for (const Vol::File* entry : vol.Select(filter)) {
+    const Vol::File& f = *entry;
+    std::cout << std::left << std::setw(12) << vol.PathOf(f) << f
+              << std::endl;
   }
 }
 
+// Prints how much '--sync' saved, and writes its manifest.
+void FinishSync(SyncManifest* sync, int num_skipped, int num_done) {
+  if (!sync) return;
+  sync->Save();
+  Log("Sync: ", num_skipped, " up to date, ", num_done, " redone.");
+}
+
 // Read individual file from the VOL and unpack them.
-void GetFiles(FileInStream& s, const Vol& vol, const std::string& out_path,
-              const std::string& pattern) {
-  const std::regex regex(pattern);
-  for (const auto& f : vol.files) {
-    const std::string path = vol.PathOf(f);
-    std::string full_name = path + std::string(f.name());
-    if (std::regex_match(full_name, regex)) {
-      const bool unzip = kAutoUnpackGz && EndsWith(full_name, ".gz");
-      if (unzip) full_name.resize(full_name.size() - 3);
-      Save(GetFileContents(s, f, unzip), out_path + full_name);
+//  - Each file is a task on 'pool'. Tasks share the (read-only) mapping.
+//  - Files are started in the order they're stored in the VOL.
+//  - With a 'sync' manifest, files that are up to date are skipped.
+//  - With a 'dedupe' index, files with the same contents as an earlier one
+//    are hard links to its output.
+void GetFiles(const MappedInStream& s, const Vol& vol,
+              const std::string& out_path, const PathFilter& filter,
+              ThreadPool& pool, SyncManifest* sync = nullptr,
+              DedupeIndex* dedupe = nullptr) {
+  const std::string settings = StrCat("get unzip=", kAutoUnpackGz);
+  std::vector<Inflater> inflaters(pool.num_threads());  // One per thread.
+  std::vector<Job> jobs;
+  int num_skipped = 0;
+  // Output names of files that are linked to the output of the first one.
+  struct Duplicate {
+    std::string first;
+    std::string name;
+    std::vector<SyncInput> inputs;
+  };
+  std::vector<Duplicate> duplicates;
+  const auto out_name_of = [&](const Vol::File& f) {
+    std::string_view name = vol.FullPathOf(f);
+    if (kAutoUnpackGz && EndsWith(name, ".gz")) name.remove_suffix(3);
+    return std::string(name);
+  };
+  for (const Vol::File* entry : vol.Select(filter)) {
+    const Vol::File& f = *entry;
+    std::string_view full_name = vol.FullPathOf(f);
+    std::vector<SyncInput> inputs;
+    if (sync) {
+      inputs.push_back(SyncInputOf(s, vol, f));
+      if (sync->UpToDate(inputs[0].path, inputs, settings)) {
+        ++num_skipped;
+        continue;
+      }
+    }
+    if (dedupe) {
+      const Vol::File& first = dedupe->Canonical(f);
+      if (&first != &f) {
+        duplicates.push_back({out_name_of(first), out_name_of(f), inputs});
+        continue;
+      }
+    }
+    const bool unzip = kAutoUnpackGz && EndsWith(full_name, ".gz");
+    if (unzip) full_name.remove_suffix(3);
+    jobs.push_back({{&f}, [&s, &f, full_name, unzip, &out_path, &inflaters,
+                           sync, &settings, inputs] {
+      const std::string out_name = out_path + std::string(full_name);
+      int64_t size = 0;
       if (unzip) {
-        std::cout << "Unzipped and wrote " << full_name << std::endl;
+        // Inflated straight to disk, a chunk at a time.
+        FileOutStream out(out_name);
+        ViewInStream file = f.ViewContents(s);
+        size = GzipMember::FromStream(
+                   file,
+                   [&out](std::string_view chunk) { out.WriteData(chunk); },
+                   &inflaters[ThreadPool::worker_index()])
+                   .inflated_size;
+        out.Close();
+        Log("Unzipped and wrote ", full_name);
       } else {
-        std::cout << "Wrote " << full_name << std::endl;
+        // Written straight from the mapping, without a copy.
+        const std::string_view data = f.ViewContents(s).data();
+        Save(data, out_name);
+        size = data.size();
+        Log("Wrote ", full_name);
       }
+      if (sync) {
+        sync->Set(inputs[0].path,
+                  {inputs, settings, {{std::string(full_name), size}}});
+      }
+    }});
+  }
+  const int num_done = jobs.size() + duplicates.size();
+  RunJobs(s, jobs, pool);
+
+  for (const Duplicate& d : duplicates) {
+    LinkOrCopy(out_path + d.first, out_path + d.name);
+    Log("Linked ", d.name, " to ", d.first);
+    if (sync) {
+      const int64_t size = std::filesystem::file_size(out_path + d.name);
+      sync->Set(d.inputs[0].path, {d.inputs, settings, {{d.name, size}}});
     }
   }
+  FinishDedupe(dedupe, duplicates.size());
+  FinishSync(sync, num_skipped, num_done);
 }
 
-// Extract OBJs for all known model types.
-void GetObjs(FileInStream& s, const Vol& vol, const std::string& out_path,
-             const std::string& pattern, bool make_wheels) {
-  const std::regex regex(pattern);
-  for (const auto& f : vol.files) {
-    const std::string path = vol.PathOf(f);
+// Extract OBJs (or GLBs) for all known model types.
+//  - Each car (object and pix pair) is a task on 'pool'.
+//  - Cars are started in the order they're stored in the VOL.
+//  - With a 'sync' manifest, cars that are up to date are skipped.
+//  - With a 'dedupe' index, a car whose object and pix are the same as an
+//    earlier car's is made from its outputs, without converting it again.
+void GetObjs(const MappedInStream& s, const Vol& vol,
+             const std::string& out_path, const PathFilter& filter,
+             bool make_wheels, CarFormat format, const ExportOptions& options,
+             ThreadPool& pool, SyncManifest* sync = nullptr,
+             DedupeIndex* dedupe = nullptr) {
+  const std::string settings = StrCat(
+      format == CarFormat::kGlb ? "glb" : "obj", " wheels=", make_wheels,
+      " profile=", static_cast<int>(options.profile),
+      " padding=", options.padding, " indexed_png=", options.indexed_png,
+      " precision=", options.precision);
+  std::vector<Inflater> inflaters(pool.num_threads());  // One per thread.
+  std::vector<Job> jobs;
+  int num_skipped = 0;
+  // Every job's output name, and what it wrote.
+  std::vector<std::string> job_names;
+  std::vector<SyncManifest::Entry> job_records;
+  // Cars made from the outputs of the first car with the same inputs.
+  struct Duplicate {
+    int job;
+    std::string name;
+    std::vector<SyncInput> inputs;
+  };
+  std::vector<Duplicate> duplicates;
+  std::map<std::pair<const Vol::File*, const Vol::File*>, int> first_jobs;
+  for (const Vol::File* entry : vol.Select(filter)) {
+    const Vol::File& f = *entry;
+    std::string_view full_name = vol.FullPathOf(f);
+    const bool unzip = EndsWith(full_name, ".gz");
+    if (unzip) full_name.remove_suffix(3);
 
-    std::string full_name = path + std::string(f.name());
-    if (std::regex_match(full_name, regex)) {
-      const bool unzip = EndsWith(full_name, ".gz");
-      if (unzip) full_name.resize(full_name.size() - 3);
+    // Extract cars.
+    if (EndsWith(full_name, ".cdo") || EndsWith(full_name, ".cno")) {
+      full_name.remove_suffix(1);  // Drop the 'o'.
+
+      // Find the texture.
+      const Vol::File* f_pix = vol.FindFile(StrCat(full_name, "p.gz"));
+      if (!f_pix) {
+        std::cerr << "Failed to find pix file for " << full_name << std::endl;
+        continue;
+      }
 
-      // Extract cars.
-      if (EndsWith(full_name, ".cdo") || EndsWith(full_name, ".cno")) {
-        full_name.resize(full_name.size() - 1);  // Drop the 'o'.
+      // Craft the output file base name.
+      const std::string out_name =
+          std::filesystem::path(full_name).filename().generic_string();
 
-        // Find the texture.
-        const Vol::File* f_pix = FindFile(vol, full_name + "p.gz");
-        if (!f_pix) {
-          std::cerr << "Failed to find pix file for " << full_name << std::endl;
+      std::vector<SyncInput> inputs;
+      if (sync) {
+        inputs = {SyncInputOf(s, vol, f), SyncInputOf(s, vol, *f_pix)};
+        if (sync->UpToDate(inputs[0].path, inputs, settings)) {
+          ++num_skipped;
           continue;
         }
+      }
 
+      if (dedupe) {
+        const auto key = std::make_pair(&dedupe->Canonical(f),
+                                        &dedupe->Canonical(*f_pix));
+        const auto [it, added] = first_jobs.emplace(key, jobs.size());
+        if (!added) {
+          duplicates.push_back({it->second, out_name, inputs});
+          continue;
+        }
+      }
+
+      const int job = jobs.size();
+      job_names.push_back(out_name);
+      jobs.push_back({{&f, f_pix}, [&s, &f, f_pix, unzip, &out_path,
+                                    out_name, make_wheels, format, &options,
+                                    &inflaters, sync, &settings, inputs,
+                                    &job_records, job] {
         // Read the object and texture data.
-        StringInStream cdo_file(GetFileContents(s, f, unzip));
-        StringInStream cdp_file(GetFileContents(s, *f_pix, unzip));
+        Inflater* inflater = &inflaters[ThreadPool::worker_index()];
+        const std::string cdo_data = GetFileContents(s, f, unzip, inflater);
+        StringInStream cdp_file(GetFileContents(s, *f_pix, unzip, inflater));
 
-        // Parse the files.
-        const CarObject cdo = CarObject::FromStream(cdo_file);
+        // Parse the files. The models are only read, so view them in place.
+        ViewInStream cdo_file(cdo_data);
+        const CarObjectView cdo = CarObjectView::FromStream(cdo_file);
         const CarPix cdp = CarPix::FromStream(cdp_file);
 
-        // Craft the output file base name.
-        const std::string out_name =
-            std::filesystem::path(full_name).filename().generic_string();
-
         // Write the OBJ data to the output path.
-        SaveObj(cdo, cdp, out_path, out_name, make_wheels);
-        std::cout << "Saved OBJ " << out_path + out_name + "..." << std::endl;
-      } else if (EndsWith(full_name, ".cdp") || EndsWith(full_name, ".cnp")) {
-        std::cout << "Use the .cdo/.cno filename to extract cars: " << full_name
-                  << std::endl;
+        SyncManifest::Entry& record = job_records[job];
+        record = {inputs, settings, {}};
+        if (format == CarFormat::kGlb) {
+          SaveGlb(cdo, cdp, out_path, out_name, make_wheels, options);
+          const std::string glb = out_name + "o.glb";
+          record.outputs.emplace_back(
+              glb, std::filesystem::file_size(out_path + glb));
+          Log("Saved GLB ", out_path, out_name, "o.glb");
+        } else {
+          ExportObj(cdo, cdp, out_name, make_wheels, options,
+                    [&](const std::string& file, std::string_view data) {
+                      Save(data, out_path + file);
+                      record.outputs.emplace_back(file, data.size());
+                    });
+          Log("Saved OBJ ", out_path, out_name, "...");
+        }
+        if (sync) sync->Set(inputs[0].path, record);
+      }});
+    } else if (EndsWith(full_name, ".cdp") || EndsWith(full_name, ".cnp")) {
+      Log("Use the .cdo/.cno filename to extract cars: ", full_name);
+    } else {
+      Log("Can't convert ", full_name);
+    }
+  }
+  const int num_done = jobs.size() + duplicates.size();
+  job_records.resize(jobs.size());
+  RunJobs(s, jobs, pool);
+
+  // Only the OBJs and MTL name the car. The rest are linked.
+  for (const Duplicate& d : duplicates) {
+    const std::string& first = job_names[d.job];
+    SyncManifest::Entry record{d.inputs, settings, {}};
+    for (const auto& [file, size] : job_records[d.job].outputs) {
+      const std::string name = d.name + file.substr(first.size());
+      if (EndsWith(file, ".obj") || EndsWith(file, ".mtl")) {
+        const std::string data =
+            RenameObjExport(Load(out_path + file), first, d.name);
+        Save(data, out_path + name);
+        record.outputs.emplace_back(name, data.size());
       } else {
-        std::cout << "Can't convert " << full_name << std::endl;
+        LinkOrCopy(out_path + file, out_path + name);
+        record.outputs.emplace_back(name, size);
       }
     }
+    Log("Linked ", out_path, d.name, "... to ", first);
+    if (sync) sync->Set(d.inputs[0].path, std::move(record));
   }
+  FinishDedupe(dedupe, duplicates.size());
+  FinishSync(sync, num_skipped, num_done);
 }
 
 // Print what we understand about the file structure.
-void InspectFiles(FileInStream& s, const Vol& vol, const std::string& pattern) {
-  const std::regex regex(pattern);
-  for (const auto& f : vol.files) {
-    const std::string path = vol.PathOf(f);
+void InspectFiles(const MappedInStream& s, const Vol& vol,
+                  const PathFilter& filter) {
+  Inflater inflater;
+  for (const Vol::File* entry : vol.Select(filter)) {
+    const Vol::File& f = *entry;
+    std::string_view full_name = vol.FullPathOf(f);
+    std::cout << std::left << std::setw(12) << vol.PathOf(f) << f
+              << std::endl;
+    const bool unzip = EndsWith(full_name, ".gz");
+    if (unzip) full_name.remove_suffix(3);
+
+    // Print information about known files.
+    if (EndsWith(full_name, ".cdo") || EndsWith(full_name, ".cno")) {
+      // Only the headers get printed; don't copy or check the rest.
+      const std::string data = GetFileContents(s, f, unzip, &inflater);
+      ViewInStream file(data);
+      const CarObjectView c =
+          CarObjectView::FromStream(file, /*check_normals=*/false);
+      std::cout << c << std::endl;
+    } else if (EndsWith(full_name, ".cdp") || EndsWith(full_name, ".cnp")) {
+      auto file = StringInStream(GetFileContents(s, f, unzip, &inflater));
+      const CarPix c = CarPix::FromStream(file);
+      std::cout << c << std::endl;
+    } else {
+      std::cout << "We don't know much about this file yet..." << std::endl;
+    }
+  }
+}
+
+// Replaces the entry at 'vol_path' in the VOL at 'path' with 'file_path'.
+void PatchEntry(const std::string& path, std::string vol_path,
+                const std::string& file_path) {
+  if (!StartsWith(vol_path, "/")) vol_path = "/" + vol_path;
+  std::string data = Load(file_path);
+  if (EndsWith(vol_path, ".gz") && !StartsWith(data, "\x1f\x8b")) {
+    const int64_t size = data.size();
+    data = GzipCompress(data, /*level=*/10);
+    Log("Gzipped ", file_path, " from ", size, " to ", data.size(), " bytes");
+  }
+
+  VolWriter writer(path);
+  const VolWriter::Patch patch = writer.Replace(vol_path, data);
+  Log(patch.in_place ? "Replaced " : "Moved ", vol_path,
+      patch.in_place ? " in place" : " to the end of the VOL", ": ",
+      data.size(), " bytes at ", patch.pos, " (", patch.bytes_written,
+      " bytes written)");
+}
 
-    std::string full_name = path + std::string(f.name());
-    if (std::regex_match(full_name, regex)) {
-      std::cout << std::left << std::setw(12) << path << f << std::endl;
+// Answers the viewer's requests for /models/ from the VOL.
+//  - '/models/' lists every car, like a directory index would.
+//  - '/models/<name>...' converts that car the first time it's asked for.
+//    Every file it makes goes into the cache, and later requests are served
+//    from there until it's evicted.
+//  - Anything else comes from 'static_path', if there is one.
+class CarServer {
+ public:
+  CarServer(const MappedInStream& s, const Vol& vol,
+            const ExportOptions& options, std::string static_path,
+            int64_t cache_bytes)
+      : s_(s),
+        options_(options),
+        static_path_(std::move(static_path)),
+        cache_(cache_bytes) {
+    for (const Vol::File& f : vol.files) {
+      std::string_view full_name = vol.FullPathOf(f);
       const bool unzip = EndsWith(full_name, ".gz");
-      if (unzip) full_name.resize(full_name.size() - 3);
-
-      // Print information about known files.
-      if (EndsWith(full_name, ".cdo") || EndsWith(full_name, ".cno")) {
-        auto file = StringInStream(GetFileContents(s, f, unzip));
-        const CarObject c = CarObject::FromStream(file);
-        std::cout << c << std::endl;
-      } else if (EndsWith(full_name, ".cdp") || EndsWith(full_name, ".cnp")) {
-        auto file = StringInStream(GetFileContents(s, f, unzip));
-        const CarPix c = CarPix::FromStream(file);
-        std::cout << c << std::endl;
-      } else {
-        std::cout << "We don't know much about this file yet..." << std::endl;
+      if (unzip) full_name.remove_suffix(3);
+      if (!EndsWith(full_name, ".cdo") && !EndsWith(full_name, ".cno")) {
+        continue;
+      }
+      full_name.remove_suffix(1);  // Drop the 'o'.
+      const Vol::File* f_pix = vol.FindFile(StrCat(full_name, "p.gz"));
+      if (!f_pix) {
+        std::cerr << "Failed to find pix file for " << full_name << std::endl;
+        continue;
+      }
+      // Names are what 'getobjs' would write, so they can collide.
+      const std::string name =
+          std::filesystem::path(full_name).filename().generic_string();
+      if (!cars_.emplace(name, Car{&f, f_pix, unzip}).second) {
+        std::cerr << "Skipping " << full_name << ": there's already a "
+                  << name << std::endl;
       }
     }
   }
-}
+
+  int num_cars() const { return cars_.size(); }
+
+  HttpResponse Get(std::string_view path) {
+    constexpr std::string_view kModels = "/models/";
+    if (path == kModels) return Listing();
+    if (StartsWith(path, kModels)) {
+      path.remove_prefix(kModels.size());
+      return CarFile(path);
+    }
+    return Static(path);
+  }
+
+ private:
+  struct Car {
+    const Vol::File* object;
+    const Vol::File* pix;
+    bool unzip;
+  };
+
+  static HttpResponse Ok(std::string_view path, LruCache::Blob body) {
+    HttpResponse out;
+    out.content_type = MimeTypeOf(path);
+    out.body = std::move(body);
+    return out;
+  }
+
+  HttpResponse Listing() const {
+    std::string html = "<html><body>\n";
+    for (const auto& [name, car] : cars_) {
+      html += StrCat("<a href=\"/models/", name, "o.0.obj\">", name,
+                     "o</a><br>\n");
+    }
+    html += "</body></html>\n";
+    HttpResponse out;
+    out.content_type = "text/html";
+    out.body = std::make_shared<const std::string>(std::move(html));
+    return out;
+  }
+
+  // The car whose files start with 'file', e.g. "car.cd" for "car.cdo.json".
+  const std::pair<const std::string, Car>* FindCar(std::string_view file) {
+    for (size_t i = file.find('.'); i != std::string_view::npos;
+         i = file.find('.', i + 1)) {
+      const auto it = cars_.find(file.substr(0, i + 3));
+      if (it != cars_.end()) return &*it;
+    }
+    return nullptr;
+  }
+
+  HttpResponse CarFile(std::string_view file) {
+    const std::string key(file);
+    if (LruCache::Blob blob = cache_.Get(key)) return Ok(file, blob);
+
+    const auto* car = FindCar(file);
+    if (!car) return HttpResponse::Error(404, "No such car.");
+    const std::string& name = car->first;
+
+    // One conversion per car at a time; others asking for it wait for it.
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      converted_.wait(lock, [&] { return converting_.count(name) == 0; });
+      if (LruCache::Blob blob = cache_.Get(key)) return Ok(file, blob);
+      converting_.insert(name);
+    }
+
+    static thread_local Inflater inflater;
+    const Car& c = car->second;
+    const std::string cdo_data =
+        GetFileContents(s_, *c.object, c.unzip, &inflater);
+    ViewInStream cdo_file(cdo_data);
+    StringInStream cdp_file(GetFileContents(s_, *c.pix, c.unzip, &inflater));
+    const CarObjectView cdo = CarObjectView::FromStream(cdo_file);
+    const CarPix cdp = CarPix::FromStream(cdp_file);
+
+    // Keep what was asked for, even if the cache can't.
+    LruCache::Blob found;
+    int64_t bytes = 0;
+    ExportObj(cdo, cdp, name, /*make_wheels=*/true, options_,
+              [&](const std::string& out_name, std::string_view data) {
+                auto blob = std::make_shared<const std::string>(data);
+                if (out_name == file) found = blob;
+                bytes += data.size();
+                cache_.Put(out_name, std::move(blob));
+              });
+    Log("Converted ", name, " (", bytes / 1024, " KiB, cache ",
+        cache_.bytes() / 1024, " KiB)");
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      converting_.erase(name);
+    }
+    converted_.notify_all();
+
+    if (!found) return HttpResponse::Error(404, "No such file for this car.");
+    return Ok(file, found);
+  }
+
+  HttpResponse Static(std::string_view path) const {
+    if (static_path_.empty()) return HttpResponse::Error(404, "Not found.");
+    if (path == "/") path = "/main.html";
+    // Stay inside 'static_path_'.
+    if (path.find("..") != std::string_view::npos) {
+      return HttpResponse::Error(400, "Bad path.");
+    }
+    const std::string local = StrCat(static_path_, path);
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(local, error)) {
+      return HttpResponse::Error(404, "Not found.");
+    }
+    return Ok(path, std::make_shared<const std::string>(Load(local)));
+  }
+
+  const MappedInStream& s_;
+  const ExportOptions& options_;
+  const std::string static_path_;
+  std::map<std::string, Car, std::less<>> cars_;
+  LruCache cache_;
+
+  std::mutex mutex_;
+  std::condition_variable converted_;
+  std::set<std::string> converting_;  // Names of cars being converted.
+};
 
 int main(int argc, char** argv) {
-  if (argc <= 1) {
+  Args args(argc, argv);
+  const int num_threads = args.PopInt("-j", 1);
+  const PathFilter::Syntax syntax =
+      (args.PopSwitch("--glob") ? PathFilter::Syntax::kGlob
+                                : PathFilter::Syntax::kRegex);
+  ExportOptions options;
+  options.indexed_png = args.PopSwitch("--indexed-png");
+  options.profile =
+      ExportProfileFromString(args.PopString("--profile", "debug"));
+  options.padding = args.PopInt("--padding", 1);
+  const int64_t cache_mb = args.PopInt("--cache-mb", 256);
+  const bool sync = args.PopSwitch("--sync");
+  const bool dedupe = args.PopSwitch("--dedupe");
+  CHECK_GE(options.padding, 0, "--padding can't be negative.");
+  CHECK_GT(cache_mb, 0, "--cache-mb needs to be positive.");
+  CHECK_GT(num_threads, 0, "-j needs at least one thread.");
+  const TraceSession trace("voltool", args.PopSwitch("--stats"),
+                           args.PopString("--trace"));
+
+  if (args.size() <= 1) {
     std::cerr << "\nNeed a vol file to open.\n" << std::endl;
     PrintUsage();
     return -1;
   }
 
+  // Patching writes to the VOL, so it mustn't be mapped.
+  if (args.size() > 2 && std::string_view(args[2]) == "patch") {
+    if (args.size() != 5) {
+      std::cerr << "\nNeed vol-path and file.\n" << std::endl;
+      PrintUsage();
+      return -1;
+    }
+    PatchEntry(args[1], args[3], args[4]);
+    return 0;
+  }
+
   // Read the VOL.
-  FileInStream s(argv[1]);
-  CHECK(s.ok(), "Failed to open '", argv[1], "'");
+  MappedInStream s(args[1]);
+  CHECK(s.ok(), "Failed to open '", args[1], "'");
   const Vol vol = Vol::FromStream(s);
   std::cout << "Read vol file " << vol.total_size << " bytes." << std::endl;
 
-  if (argc <= 2) {
+  if (args.size() <= 2) {
     std::cerr << "\nNeed a command to complete.\n" << std::endl;
     PrintUsage();
     return -1;
   }
 
-  const std::string_view command(argv[2]);
+  ThreadPool pool(num_threads);
+
+  const std::string_view command(args[2]);
+
+  // The '--sync' manifest for a command's output, or null without '--sync'.
+  const auto make_sync = [&](const std::string& out_path) {
+    return sync ? std::make_unique<SyncManifest>(
+                      out_path, command,
+                      std::filesystem::absolute(args[1]).generic_string())
+                : nullptr;
+  };
+  // The '--dedupe' index, or null without '--dedupe'.
+  const auto make_dedupe = [&] {
+    return dedupe ? std::make_unique<DedupeIndex>(s, vol) : nullptr;
+  };
   if (command == "dirs") {
     // List directories in the VOL.
     ListDirs(vol);
   } else if (command == "list") {
     // List files in the VOL.
-    const std::string pattern(argc > 3 ? argv[3] : ".*");
-    ListFiles(vol, pattern);
+    const PathFilter filter(args.size() > 3 ? args[3] : ".*", syntax);
+    ListFiles(vol, filter);
   } else if (command == "get") {
     // Pull files out of the VOL.
-    if (argc != 5) {
+    if (args.size() != 5) {
       std::cerr << "\nNeed output-path and regex-pattern.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    const std::string out_path(argv[3]);
-    const std::string pattern(argv[4]);
-    GetFiles(s, vol, out_path, pattern);
+    const std::string out_path(args[3]);
+    const PathFilter filter(args[4], syntax);
+    GetFiles(s, vol, out_path, filter, pool, make_sync(out_path).get(),
+             make_dedupe().get());
   } else if (command == "getobjs") {
-    if (argc != 5) {
+    if (args.size() != 5) {
       std::cerr << "\nNeed output-path and regex-pattern.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    const std::string out_path(argv[3]);
-    const std::string pattern(argv[4]);
-    GetObjs(s, vol, out_path, pattern, /*make_wheels=*/true);
+    const std::string out_path(args[3]);
+    const PathFilter filter(args[4], syntax);
+    GetObjs(s, vol, out_path, filter, /*make_wheels=*/true, CarFormat::kObj,
+            options, pool, make_sync(out_path).get(),
+            make_dedupe().get());
   } else if (command == "getobjs-nowheels") {
-    if (argc != 5) {
+    if (args.size() != 5) {
       std::cerr << "\nNeed output-path and regex-pattern.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    const std::string out_path(argv[3]);
-    const std::string pattern(argv[4]);
-    GetObjs(s, vol, out_path, pattern, /*make_wheels=*/false);
+    const std::string out_path(args[3]);
+    const PathFilter filter(args[4], syntax);
+    GetObjs(s, vol, out_path, filter, /*make_wheels=*/false, CarFormat::kObj,
+            options, pool, make_sync(out_path).get(),
+            make_dedupe().get());
+  } else if (command == "getglb") {
+    if (args.size() != 5) {
+      std::cerr << "\nNeed output-path and regex-pattern.\n" << std::endl;
+      PrintUsage();
+      return -1;
+    }
+    const std::string out_path(args[3]);
+    const PathFilter filter(args[4], syntax);
+    GetObjs(s, vol, out_path, filter, /*make_wheels=*/true, CarFormat::kGlb,
+            options, pool, make_sync(out_path).get(),
+            make_dedupe().get());
   } else if (command == "inspect") {
     // Get better information about files.
-    if (argc != 4) {
+    if (args.size() != 4) {
       std::cerr << "\nNeed a regex-pattern.\n" << std::endl;
       PrintUsage();
       return -1;
     }
-    const std::string pattern(argv[3]);
-    InspectFiles(s, vol, pattern);
+    const PathFilter filter(args[3], syntax);
+    InspectFiles(s, vol, filter);
+  } else if (command == "serve") {
+    // Convert cars for the viewer as it asks for them.
+    if (args.size() != 4 && args.size() != 5) {
+      std::cerr << "\nNeed a :port.\n" << std::endl;
+      PrintUsage();
+      return -1;
+    }
+    std::string_view port(args[3]);
+    if (StartsWith(port, ":")) port.remove_prefix(1);
+    int port_number = 0;
+    const auto r =
+        std::from_chars(port.data(), port.data() + port.size(), port_number);
+    CHECK(r.ec == std::errc() && r.ptr == port.data() + port.size() &&
+              port_number > 0 && port_number < 65536,
+          "Bad port '", args[3], "'");
+
+    CarServer cars(s, vol, options, args.size() == 5 ? args[4] : "",
+                   cache_mb << 20);
+    HttpServer server(port_number);
+    CHECK(server.ok(), "Failed to listen on port ", port_number);
+    Log("Serving ", cars.num_cars(), " cars at http://127.0.0.1:",
+        port_number, "/");
+    server.Serve([&cars](std::string_view path) { return cars.Get(path); },
+                 pool);
   } else {
     // Fail.
     std::cerr << "Unknown command '" << command << "'" << std::endl;
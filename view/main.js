@@ -11,13 +11,14 @@ import * as THREE from './3p/three.js/three.module.js';
 // REQUESTS
 ////////////////////////////////////////////////////////////////////////////////
 
-// Performs an XHR to get the given URL.
+// Performs an XHR to get the given URL. Returns it, so it can be aborted.
 function getUrl(url, onLoad, onError) {
   const r = new XMLHttpRequest();
   r.addEventListener('load', () => onLoad(r.response));
   r.addEventListener('error', () => onError(r.status, r.statusText));
   r.open('GET', url);
   r.send();
+  return r;
 }
 
 // Performs an XHR to get a URL and parses the result as JSON.
@@ -80,6 +81,32 @@ function replaceNestedMaterials(obj, func) {
   });
 }
 
+// Makes a built-in material look its colors up in a palette strip. Its 'map'
+// must be an index texture: gray is the index, alpha the mask. 'uniforms'
+// holds the strip (one palette per row), and is shared, so picking a skin is
+// just a change to 'uniforms.skin'.
+function usePaletteLookup(mat, uniforms) {
+  mat.onBeforeCompile = shader => {
+    Object.assign(shader.uniforms, uniforms);
+    shader.fragmentShader = `
+uniform sampler2D palettes;
+uniform float skin;
+uniform float numSkins;
+` + shader.fragmentShader.replace('#include <map_fragment>', `
+#ifdef USE_MAP
+  vec4 texelIndex = texture2D( map, vUv );
+  float index = floor( texelIndex.r * 255.0 + 0.5 );
+  vec4 texelColor = texture2D( palettes,
+      vec2( ( index + 0.5 ) / 256.0, ( skin + 0.5 ) / numSkins ) );
+  texelColor = sRGBToLinear( texelColor );
+  texelColor.a *= texelIndex.a;
+  diffuseColor *= texelColor;
+#endif
+`);
+  };
+  mat.needsUpdate = true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // BACKDROPS
 ////////////////////////////////////////////////////////////////////////////////
@@ -149,16 +176,43 @@ function createGarage() {
 // MODELS (CARS)
 ////////////////////////////////////////////////////////////////////////////////
 
+// Picks the LODs to request from an o.json manifest, coarsest first. A coarse
+// LOD that isn't much smaller than LOD 0 would only delay it, so it's skipped.
+function planLods(manifest) {
+  const sizes = manifest.lod_sizes || [];
+  const plan = [];
+  for (let i = manifest.lods - 1; i > 0; --i) {
+    if (sizes.length <= i || sizes[i] < 0.5 * sizes[0]) plan.push(i);
+  }
+  plan.push(0);
+  return plan;
+}
+
 class Model {
   constructor() {
-    this.currentLod = 0;
+    this.currentLod = -1;  // Finest LOD loaded so far, if any.
     this.currentSkin = 0;
     this.lods = [];   // THREE.Object3D()
     this.skins = [];  // THREE.Texture()
+    // Uniforms for 'usePaletteLookup', if the skins come from a palette strip.
+    this.palettes = null;
+  }
+
+  // Switches to skins looked up on the GPU, from 'numSkins' rows of 'tex'.
+  usePaletteStrip(tex, numSkins) {
+    this.palettes = {
+      palettes: {value: tex},
+      skin: {value: this.currentSkin},
+      numSkins: {value: numSkins},
+    };
+  }
+
+  numSkins() {
+    return this.palettes ? this.palettes.numSkins.value : this.skins.length;
   }
 
   getVisual() {
-    return this.lods[this.currentLod];
+    return this.currentLod < 0 ? null : this.lods[this.currentLod];
   }
 
   updateLod(i, lod) {
@@ -181,6 +235,7 @@ class Model {
     g.add(lod);
     g.add(shadow);
     this.lods[i] = g;
+    if (this.currentLod < 0 || i < this.currentLod) this.currentLod = i;
   }
 
   updateSkin(i, tex) {
@@ -190,8 +245,11 @@ class Model {
   }
 
   pickSkin(i) {
-    i = Math.min(this.skins.length - 1, Math.max(0, i));
-    if (i != this.currentSkin) {
+    i = Math.min(this.numSkins() - 1, Math.max(0, i));
+    if (i != this.currentSkin && this.palettes) {
+      this.palettes.skin.value = i;
+      this.currentSkin = i;
+    } else if (i != this.currentSkin) {
       for (let lod of this.lods) {
         for (let mat of getNestedMaterials(lod)) {
           if (mat.map != this.skins[i]) {
@@ -236,6 +294,8 @@ class World {
     this.model = null;  // Contains several lods of type THREE.Object3d.
     // Currently displayed visual (may lag behind 'model' if loading).
     this.visual = null;  // Is a THREE.Object3d.
+    // In-flight XHRs for 'model'.
+    this.requests = [];
 
     // Last time 'update()' was called.
     this.lastT = 0;
@@ -322,8 +382,15 @@ class World {
     this.scene.background = bg;
   }
 
+  // Aborts the requests for a model that's no longer wanted.
+  cancelRequests() {
+    for (let r of this.requests) r.abort();
+    this.requests = [];
+  }
+
   loadCar(name) {
     console.log('loading', name);
+    this.cancelRequests();
 
     const setCarTexParams = tex => {
       tex.encoding = THREE.sRGBEncoding;
@@ -331,46 +398,105 @@ class World {
       tex.minFilter = THREE.NearestFilter;
     };
 
+    // Index textures and palette strips hold numbers, not colors.
+    const setIndexTexParams = tex => {
+      tex.encoding = THREE.LinearEncoding;
+      tex.magFilter = THREE.NearestFilter;
+      tex.minFilter = THREE.NearestFilter;
+      tex.generateMipmaps = false;
+    };
+
     const path = name;
     const model = new Model();
 
-    // Loads the json listing for this model.
-    getJson(
-        path + 'o.json',
-        result => {
-          // Skip the first skin. It's loaded from the .mtl.
-          for (let i = 1; i < result.palettes; ++i) {
-            const tex_path = path + 'p.' + i + '.png';
-            const tex = new THREE.TextureLoader().load(tex_path);
-            setCarTexParams(tex);
-            model.updateSkin(i, tex);
-          }
-        },
-        (code, text) => {
-          console.log('Request failed', code, text);
-        });
+    // Gets 'url' for this model. Results are dropped if another model has been
+    // requested since; its requests are aborted anyway.
+    //  - HTTP errors (e.g. a 404 for a file the export didn't write) still
+    //    'load', so they're sent to 'onError' here.
+    const request = (url, onLoad, onError) => {
+      const fail = (code, text) => {
+        console.log('Request failed', url, code, text);
+        if (this.model === model && onError) onError();
+      };
+      const r = getUrl(
+          url,
+          result => {
+            this.requests = this.requests.filter(x => x !== r);
+            if (r.status < 200 || r.status >= 300) {
+              fail(r.status, r.statusText);
+            } else if (this.model === model) {
+              onLoad(result);
+            }
+          },
+          (code, text) => {
+            this.requests = this.requests.filter(x => x !== r);
+            fail(code, text);
+          });
+      this.requests.push(r);
+    };
+
+    // Streams the LODs in 'plan' one after the other. Each is shown as soon as
+    // it's parsed, replacing the coarser one before it. One that fails is
+    // skipped, so the finest (LOD 0) is always fetched.
+    const loadLods = (materials, plan) => {
+      if (plan.length == 0) return;
+      const i = plan[0];
+      const next = () => loadLods(materials, plan.slice(1));
+      request(path + 'o.' + i + '.obj', text => {
+        const objLoader = new OBJLoader();
+        objLoader.setMaterials(materials);
+        model.updateLod(i, objLoader.parse(text));
+        this.setVisual(model.getVisual());
+        next();
+      }, next);
+    };
 
     // Load the MTL first, otherwise the OBJ load races with the texture load...
-    new MTLLoader().load(path + 'o.mtl', m => {
-      const objLoader = new OBJLoader();
-      objLoader.setMaterials(m);
-      objLoader.load(path + 'o.0.obj', o => {
-        for (let m of getNestedMaterials(o)) {
-          if (m.map) {
-            m.alphaTest = 0.005;
+    // Every LOD shares its materials, so skins only need setting up once.
+    const loadModel = plan => request(path + 'o.mtl', text => {
+      const dir = THREE.LoaderUtils.extractUrlBase(path + 'o.mtl');
+      const materials = new MTLLoader().parse(text, dir);
+      materials.preload();
+      for (let m of Object.values(materials.materials)) {
+        if (m.map) {
+          m.alphaTest = 0.005;
+          if (model.palettes) {
+            setIndexTexParams(m.map);
+            usePaletteLookup(m, model.palettes);
+          } else {
             setCarTexParams(m.map);
             model.updateSkin(0, m.map);
           }
         }
-        model.updateLod(0, o);
-        // Only update the currently displayed visual if this is still the model
-        // we want. A new one may have been requested already.
-        if (this.model === model) {
-          this.setVisual(model.getVisual());
-        }
-      });
+      }
+      loadLods(materials, plan);
     });
 
+    // Loads the json listing for this model. It says how the skins are stored
+    // and which LODs there are, so the model waits for it.
+    request(
+        path + 'o.json',
+        text => {
+          const result = JSON.parse(text);
+          if (result.palette_strip) {
+            // One texture for every skin (see '--profile gpu').
+            const tex = new THREE.TextureLoader().load(path + 'p.strip.png');
+            setIndexTexParams(tex);
+            tex.flipY = false;
+            model.usePaletteStrip(tex, result.palettes);
+          } else {
+            // Skip the first skin. It's loaded from the .mtl.
+            for (let i = 1; i < result.palettes; ++i) {
+              const tex_path = path + 'p.' + i + '.png';
+              const tex = new THREE.TextureLoader().load(tex_path);
+              setCarTexParams(tex);
+              model.updateSkin(i, tex);
+            }
+          }
+          loadModel(planLods(result));
+        },
+        () => loadModel([0]));
+
     // This is the currently loading model. May be replaced before it's actually
     // complete.
     this.model = model;